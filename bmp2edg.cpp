@@ -20,24 +20,33 @@
 #include "stb/stb_image.h"
 #include "libedg.cpp"
 
+#include <iostream> // std::cout
+
 int main(int argc, char ** argv)
 {
-    if(argc < 3) return puts("Usage: bmp2edg in.bmp out.edg"), 0;
+    if(argc < 3) return puts("Usage: bmp2edg in.bmp out.edg\n\"-\" reads from stdin or writes to stdout."), 0;
     
+    // errors go to stderr, so they don't end up in a pipe
     int x, y, n;
-    auto data = stbi_load(argv[1], &x, &y, &n, 0);
-    if(!data) return printf("stbi_load with file \"%s\" failed: %s\n", argv[1], stbi_failure_reason()), 0;
+    auto data = strcmp(argv[1], "-") == 0 ? stbi_load_from_file(stdin, &x, &y, &n, 0) : stbi_load(argv[1], &x, &y, &n, 0);
+    if(!data) return fprintf(stderr, "stbi_load with file \"%s\" failed: %s\n", argv[1], stbi_failure_reason()), 0;
+    
+    edginfo info = {};
+    info.height = y-1;
+    info.width = x-1;
+    info.format = 0;
+    info.grayscale = n<=2;
+    info.alpha = !(n&1);
+    info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
     
-    auto edge = edg_make(y-1, x-1, 0, n<=2, !(n&1));
-    if(!edge) return printf("edg_make failed: %s\n", edgerr), 0;
+    // stb's buffer is already laid out like an 8-bit EDG, so hand it over instead of copying it
+    auto edge = edg_wrap(&info, data, uint64_t(x)*y*n, [](unsigned char * data, void *){ stbi_image_free(data); });
+    if(!edge) return fprintf(stderr, "edg_wrap failed: %s\n", edgerr), 0;
     
-    auto olddata = edge->data;
-    edge->data = data;
-    if(edg_save(edge, argv[2])) return printf("edg_save with file %s failed: %s\n", argv[2], edgerr), 0;
-    edge->data = olddata;
+    auto rcode = strcmp(argv[2], "-") == 0 ? edg_save_stream(edge, std::cout) : edg_save(edge, argv[2]);
+    if(rcode) return fprintf(stderr, "edg_save with file %s failed: %s\n", argv[2], edgerr), 0;
     
     edg_kill(edge);
-    stbi_image_free(data);
     
     return 0;
 }
@@ -14,34 +14,39 @@
    limitations under the LICENSE.
 */
 
-#include <math.h> // roundf
-
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 #include "libedg.cpp"
 
+#include <iostream> // std::cin
+
 #define values(edge) ((edge->info.grayscale?1:3)+edge->info.alpha)
 #define value_length(edge) (edge->info.format?4:1)
 #define pixel_length(edge) (values(edge)*value_length(edge))
 
 int main(int argc, char ** argv)
 {
-    if(argc < 3) return puts("Usage: edg2bmp in.edg out.bmp"), 0;
+    if(argc < 3) return puts("Usage: edg2bmp in.edg out.bmp\n\"-\" reads from stdin or writes to stdout."), 0;
     
-    auto edge = edg_open(argv[1]);
-    if(!edge) return printf("edg_open(\"%s\") failed: %s\n", argv[1], edgerr), 0;
+    // errors go to stderr, so they don't end up in a pipe
+    auto edge = strcmp(argv[1], "-") == 0 ? edg_open_stream(std::cin) : edg_open(argv[1]);
+    if(!edge) return fprintf(stderr, "edg_open(\"%s\") failed: %s\n", argv[1], edgerr), 0;
     
-    auto buffer = edge->data;
+    // BMPs hold 8-bit sRGB
     if(edge->info.format)
     {
-        buffer = (unsigned char *)malloc(edge->size/4);
-        for(uint64_t i = 0; i < edge->size; i += 4)
-            buffer[i/4] = roundf(255*fmin(1.0f, fmax(0.0f, linear2srgb(((float*)(edge->data))[i]))));
+        auto converted = edg_convert(edge, false, edge->info.grayscale, edge->info.alpha);
+        edg_kill(edge);
+        if(!converted) return fprintf(stderr, "edg_convert failed: %s\n", edgerr), 0;
+        edge = converted;
     }
+    auto buffer = edge->data;
     
-    if(!stbi_write_bmp(argv[2], uint64_t(edge->info.width)+1, uint64_t(edge->info.height)+1, values(edge), buffer));
+    if(strcmp(argv[2], "-") == 0)
+        stbi_write_bmp_to_func([](void *, void * data, int size){ fwrite(data, 1, size, stdout); }, nullptr, uint64_t(edge->info.width)+1, uint64_t(edge->info.height)+1, values(edge), buffer);
+    else
+        stbi_write_bmp(argv[2], uint64_t(edge->info.width)+1, uint64_t(edge->info.height)+1, values(edge), buffer);
     
-    if(buffer != edge->data) free(buffer);
     edg_kill(edge);
     
     return 0;
@@ -27,12 +27,10 @@
 // TODO: Add a mode for quantized edge detection, instead of blending
 
 #include "libedg.cpp"
+#include "libedg_view.hpp"
 
 #include <math.h> // roundf
-
-#define values(edge) ((edge->info.grayscale?1:3)+edge->info.alpha)
-#define value_length(edge) (edge->info.format?4:1)
-#define pixel_length(edge) (values(edge)*value_length(edge))
+#include <iostream> // std::cin, std::cout
 
 int max(int a, int b)
 {
@@ -43,30 +41,39 @@ int min(int a, int b)
     return (a<b)?a:b;
 }
 
-// value index, not byte index
-uint64_t index(edg* edge, int64_t y, int64_t x, int channel)
+// u8 values scaled to 0-1, so that reading a u8 image doesn't divide on every access
+const float * unorm8 = get_unorm8_table().values;
+
+// reads past the edge of the image clamp to it
+template<typename View>
+uint64_t clamp_y(const View & view, int64_t y)
 {
-    if(y < 0) y = 0;
-    if(y > edge->info.height) y = edge->info.height;
-    if(x < 0) x = 0;
-    if(x > edge->info.width) x = edge->info.width;
-    if(channel < 0) channel = 0;
-    if(channel > values(edge)-1) channel = values(edge)-1;
-    return (y*(uint64_t(edge->info.width)+1)+x)*values(edge) + channel;
+    if(y < 0) return 0;
+    if(uint64_t(y) >= view.height) return view.height-1;
+    return y;
 }
-float edg_read(edg* edge, int64_t y, int64_t x, int channel)
+template<typename View>
+uint64_t clamp_x(const View & view, int64_t x)
 {
-    if(edge->info.format)
-        return ((float*)(edge->data))[index(edge, y, x, channel)];
-    else
-        return ((edge->data[index(edge, y, x, channel)])/255.0f);
+    if(x < 0) return 0;
+    if(uint64_t(x) >= view.width) return view.width-1;
+    return x;
 }
-void edg_write(edg* edge, int64_t y, int64_t x, int channel, float value)
+
+inline float to_float(float value) { return value; }
+inline float to_float(uint8_t value) { return unorm8[value]; }
+inline void from_float(float & out, float value) { out = value; }
+inline void from_float(uint8_t & out, float value) { out = min(255, max(0, roundf((value)*255.0f))); }
+
+template<typename View>
+float edg_read(const View & view, int64_t y, int64_t x, int channel)
 {
-    if(edge->info.format)
-        ((float*)(edge->data))[index(edge, y, x, channel)] = value;
-    else
-        edge->data[index(edge, y, x, channel)] = min(255, max(0, roundf((value)*255.0f)));
+    return to_float(view(clamp_y(view, y), clamp_x(view, x), channel));
+}
+template<typename View>
+void edg_write(const View & view, int64_t y, int64_t x, int channel, float value)
+{
+    from_float(view(clamp_y(view, y), clamp_x(view, x), channel), value);
 }
 
 struct vector {
@@ -74,7 +81,8 @@ struct vector {
     float y;
 };
 
-vector normal(edg* edge, int64_t y, int64_t x, int yup, int xup, int yright, int xright, int channel)
+template<typename View>
+vector normal(const View & edge, int64_t y, int64_t x, int yup, int xup, int yright, int xright, int channel)
 {
     vector retval;
     retval.x = 0;
@@ -105,7 +113,8 @@ vector normal(edg* edge, int64_t y, int64_t x, int yup, int xup, int yright, int
 }
 
 
-float badedi(edg* edge, int64_t y, int64_t x, int yup, int xup, int yright, int xright, int channel)
+template<typename View>
+float badedi(const View & edge, int64_t y, int64_t x, int yup, int xup, int yright, int xright, int channel)
 {
     vector p1 = normal(edge, y+yup+yright, x+xup+xright, yup, xup, yright, xright, channel);
     vector p2 = normal(edge, y+yup       , x+xup       , yup, xup, yright, xright, channel);
@@ -140,71 +149,82 @@ float badedi(edg* edge, int64_t y, int64_t x, int yup, int xup, int yright, int
 
 
 // diagonal crosshatch
-float badedi1(edg* edge, int64_t y, int64_t x, int channel)
+template<typename View>
+float badedi1(const View & edge, int64_t y, int64_t x, int channel)
 {
     return badedi(edge, y, x, 2, 0, 0, 2, channel);
 }
 
 // axial crosshatch
-float badedi2(edg* edge, int64_t y, int64_t x, int channel)
+template<typename View>
+float badedi2(const View & edge, int64_t y, int64_t x, int channel)
 {
     return badedi(edge, y, x, 1, 1, -1, 1, channel);
 }
 
 int main(int argc, char ** argv)
 {
-    if(argc < 3) return puts("Usage: edg2bmp in.edg out.edg"), 0;
+    if(argc < 3) return puts("Usage: edgpop in.edg out.edg\n\"-\" reads from stdin or writes to stdout."), 0;
     
-    auto edge = edg_open(argv[1]);
-    if(!edge) return printf("edg_open(\"%s\") failed: %s\n", argv[1], edgerr), 0;
+    // errors go to stderr, so they don't end up in a pipe
+    auto edge = strcmp(argv[1], "-") == 0 ? edg_open_stream(std::cin) : edg_open(argv[1]);
+    if(!edge) return fprintf(stderr, "edg_open(\"%s\") failed: %s\n", argv[1], edgerr), 0;
     auto pop = edg_make(edge->info.height*2, edge->info.width*2, edge->info.format, edge->info.grayscale, edge->info.alpha);
-    if(!pop) return printf("edg_make() failed: %s\n", edgerr), 0;
-    
-    int values = (edge->info.grayscale?1:3)+edge->info.alpha;
+    if(!pop) return fprintf(stderr, "edg_make() failed: %s\n", edgerr), 0;
     
-    // source pass
-    for(int64_t y = 0; y <= pop->info.height; y++)
-        for(int64_t x = 0; x <= pop->info.width; x++)
-            for(int i = 0; i < values; i++)
-                if(!(x&1) and !(y&1))
-                    edg_write(pop, y, x, i, edg_read(edge, y/2, x/2, i));
-    // cross hatch pass
-    for(int64_t y = 0; y <= pop->info.height; y++)
+    // the image and the upscale share a layout, so one dispatch covers both
+    edg_visit(edge, [pop](auto src)
     {
-        for(int64_t x = 0; x <= pop->info.width; x++)
+        decltype(src) dst(pop);
+        const int values = decltype(src)::channels;
+        
+        // source pass
+        for(int64_t y = 0; uint64_t(y) < dst.height; y++)
+            for(int64_t x = 0; uint64_t(x) < dst.width; x++)
+                for(int i = 0; i < values; i++)
+                    if(!(x&1) and !(y&1))
+                        edg_write(dst, y, x, i, edg_read(src, y/2, x/2, i));
+        // cross hatch pass
+        for(int64_t y = 0; uint64_t(y) < dst.height; y++)
         {
-            for(int i = 0; i < values; i++)
+            for(int64_t x = 0; uint64_t(x) < dst.width; x++)
             {
-                if((x&1) and (y&1))
+                for(int i = 0; i < values; i++)
                 {
-                    #ifdef EDI
-                    edg_write(pop, y, x, i, badedi1(pop, y-1, x-1, i));
-                    #else // EDI
-                    edg_write(pop, y, x, i,
-                        (edg_read(pop, y-1, x-1, i)+
-                         edg_read(pop, y+1, x-1, i)+
-                         edg_read(pop, y+1, x+1, i)+
-                         edg_read(pop, y-1, x+1, i)
-                        )/4);
-                    #endif // EDI else
+                    if((x&1) and (y&1))
+                    {
+                        #ifdef EDI
+                        edg_write(dst, y, x, i, badedi1(dst, y-1, x-1, i));
+                        #else // EDI
+                        edg_write(dst, y, x, i,
+                            (edg_read(dst, y-1, x-1, i)+
+                             edg_read(dst, y+1, x-1, i)+
+                             edg_read(dst, y+1, x+1, i)+
+                             edg_read(dst, y-1, x+1, i)
+                            )/4);
+                        #endif // EDI else
+                    }
+                    if((x&1) and !(y&1))
+                        edg_write(dst, y, x, i, (edg_read(dst, y, x+1, i)+edg_read(dst, y, x-1, i))/2);
+                    #ifndef EDI2
+                    if(!(x&1) and (y&1))
+                        edg_write(dst, y, x, i, (edg_read(dst, y-1, x, i)+edg_read(dst, y+1, x, i))/2);
+                    #endif
                 }
-                if((x&1) and !(y&1))
-                    edg_write(pop, y, x, i, (edg_read(pop, y, x+1, i)+edg_read(pop, y, x-1, i))/2);
-                #ifndef EDI2
-                if(!(x&1) and (y&1))
-                    edg_write(pop, y, x, i, (edg_read(pop, y-1, x, i)+edg_read(pop, y+1, x, i))/2);
-                #endif
             }
         }
-    }
-    #ifdef EDI2
-    // axial pass
-    for(int64_t y = 0; y <= pop->info.height; y++)
-        for(int64_t x = 0; x <= pop->info.width; x++)
-            for(int i = 0; i < values; i++)
-                if((x&1) xor (y&1))
-                    edg_write(pop, y, x, i, badedi2(pop, y, x-1, i));
-    #endif
+        #ifdef EDI2
+        // axial pass
+        for(int64_t y = 0; uint64_t(y) < dst.height; y++)
+            for(int64_t x = 0; uint64_t(x) < dst.width; x++)
+                for(int i = 0; i < values; i++)
+                    if((x&1) xor (y&1))
+                        edg_write(dst, y, x, i, badedi2(dst, y, x-1, i));
+        #endif
+    });
     // save
-    edg_save(pop, argv[2]);
+    if(strcmp(argv[2], "-") == 0)
+        edg_save_stream(pop, std::cout);
+    else
+        edg_save(pop, argv[2]);
 }
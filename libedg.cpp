@@ -39,6 +39,30 @@
 #include <math.h>
 #include <functional> // std::function (for defer)
 #include <limits.h> // CHAR_BIT
+#include <thread> // edg_probe_batch
+#include <system_error> // std::system_error, thrown when a thread can't be started
+#include <atomic>
+#include <vector>
+#include <limits> // std::numeric_limits
+#include <mutex> // edg_loader
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <new> // placement new (for edg_new)
+#include <map> // buffer pool
+#include <iterator> // std::prev
+
+#if defined(__unix__) || defined(__APPLE__)
+#define EDG_POSIX 1
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <sys/stat.h> // fstat
+#include <sys/mman.h> // mmap
+#include <sys/uio.h> // writev
+#include <errno.h>
+#else
+#define EDG_POSIX 0
+#endif
 
 static_assert(CHAR_BIT == 8, "Platform does not use 8-bit bytes.");
 
@@ -76,6 +100,9 @@ void reverse(unsigned char * location, int length)
     }
 }
 
+#include "libedg_byteswap.cpp"
+#include "libedg_srgb.cpp"
+
 struct defer
 {
     std::function<void(void)> deferred;
@@ -83,13 +110,218 @@ struct defer
     ~defer() { deferred(); }
 };
 
-const char * edgerr = "";
+thread_local const char * edgerr = "";
+
+// Allocation goes through these, so that it can be redirected with edg_set_allocator.
+
+void * default_alloc(uint64_t size, void *)
+{
+    if(uint64_t(size_t(size)) != size) return nullptr;
+    return malloc(size);
+}
+
+void default_free(void * memory, void *)
+{
+    free(memory);
+}
+
+void * default_aligned_alloc(uint64_t alignment, uint64_t size, void *)
+{
+    if(uint64_t(size_t(size)) != size) return nullptr;
+    #if EDG_POSIX
+    void * memory;
+    if(posix_memalign(&memory, alignment, size) != 0) return nullptr;
+    return memory;
+    #else
+    (void)alignment;
+    return nullptr;
+    #endif
+}
+
+edg_allocator allocator = {default_alloc, default_free, default_aligned_alloc, nullptr};
+
+void * edg_allocate(uint64_t size)
+{
+    return allocator.alloc(size, allocator.userdata);
+}
+
+// Zeroed memory. The default allocator uses calloc, which gets fresh pages from the OS already zeroed, so zero-filling large images costs nothing up front.
+void * edg_allocate_zeroed(uint64_t size)
+{
+    if(allocator.alloc == default_alloc)
+        return uint64_t(size_t(size)) == size ? calloc(size, 1) : nullptr;
+    void * memory = edg_allocate(size);
+    if(memory) memset(memory, 0, size);
+    return memory;
+}
+
+void * edg_allocate_aligned(uint64_t alignment, uint64_t size)
+{
+    if(!allocator.aligned_alloc) return nullptr;
+    return allocator.aligned_alloc(alignment, size, allocator.userdata);
+}
+
+void edg_deallocate(void * memory)
+{
+    if(memory) allocator.free(memory, allocator.userdata);
+}
+
+// new and delete for library structs, through the allocator.
+template<typename T>
+T * edg_new()
+{
+    void * memory = edg_allocate(sizeof(T));
+    if(!memory) return nullptr;
+    return new (memory) T;
+}
+
+template<typename T>
+void edg_delete(T * object)
+{
+    if(!object) return;
+    object->~T();
+    edg_deallocate(object);
+}
+
+// When the pool is enabled, pixel buffers are rounded up to a size class and recycled through it instead of going back to the allocator.
+// With it off, they're allocated at exactly the size asked for, so custom allocators see the sizes they'd expect.
+// Classes are a quarter of a power of two apart, so a buffer wastes at most a fifth of itself.
+// Buffers smaller than pool_min_bytes are always exact, and never pooled: malloc handles those well enough on its own.
+
+const uint64_t pool_min_bytes = 0x10000;
+
+struct buffer_pool
+{
+    std::mutex mutex;
+    std::map<uint64_t, std::vector<unsigned char *>> free_buffers; // keyed by size class
+    edg_pool_stats stats = {};
+};
+
+buffer_pool pool;
+
+uint64_t pool_size_class(uint64_t bytes)
+{
+    if(bytes < pool_min_bytes) return bytes;
+    uint64_t step = pool_min_bytes/4;
+    while(step <= bytes/8) step *= 2; // not step*8 <= bytes, which wraps around for huge sizes
+    uint64_t size_class = (bytes+step-1)/step*step;
+    return size_class < bytes ? bytes : size_class; // overflow near 2^64; the allocation will fail anyway
+}
+
+void pool_trim_locked()
+{
+    for(auto & bucket : pool.free_buffers)
+        for(unsigned char * buffer : bucket.second)
+            edg_deallocate(buffer);
+    pool.free_buffers.clear();
+    pool.stats.cached_bytes = 0;
+    pool.stats.cached_buffers = 0;
+}
+
+// Allocates a pixel buffer of at least "bytes" bytes, taking it from the pool if one of the right size class is there.
+// *capacity receives the size actually allocated, which edg_release_pixels needs back.
+unsigned char * edg_allocate_pixels(uint64_t bytes, uint64_t * capacity, bool zeroed)
+{
+    *capacity = bytes;
+    if(bytes >= pool_min_bytes)
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if(pool.stats.limit > 0)
+        {
+            uint64_t size_class = pool_size_class(bytes);
+            *capacity = size_class;
+            auto bucket = pool.free_buffers.find(size_class);
+            if(bucket != pool.free_buffers.end() and !bucket->second.empty())
+            {
+                unsigned char * buffer = bucket->second.back();
+                bucket->second.pop_back();
+                pool.stats.cached_bytes -= size_class;
+                pool.stats.cached_buffers--;
+                pool.stats.hits++;
+                if(zeroed) memset(buffer, 0, size_class);
+                return buffer;
+            }
+            pool.stats.misses++;
+        }
+    }
+    return (unsigned char *)(zeroed ? edg_allocate_zeroed(*capacity) : edg_allocate(*capacity));
+}
+
+// Releases a pixel buffer, keeping it in the pool if it's enabled, the buffer is a whole size class, and there's room under the limit.
+void edg_release_pixels(unsigned char * data, uint64_t capacity)
+{
+    if(!data) return;
+    if(capacity >= pool_min_bytes and pool_size_class(capacity) == capacity)
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if(pool.stats.limit > 0)
+        {
+            if(pool.stats.cached_bytes+capacity <= pool.stats.limit)
+            {
+                pool.free_buffers[capacity].push_back(data);
+                pool.stats.cached_bytes += capacity;
+                pool.stats.cached_buffers++;
+                pool.stats.returned++;
+                return;
+            }
+            pool.stats.dropped++;
+        }
+    }
+    edg_deallocate(data);
+}
+
+void edg_pool_set_limit(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.stats.limit = bytes;
+    // evict the largest buffers first until everything fits
+    while(pool.stats.cached_bytes > bytes)
+    {
+        auto bucket = std::prev(pool.free_buffers.end());
+        if(bucket->second.empty())
+        {
+            pool.free_buffers.erase(bucket);
+            continue;
+        }
+        edg_deallocate(bucket->second.back());
+        bucket->second.pop_back();
+        pool.stats.cached_bytes -= bucket->first;
+        pool.stats.cached_buffers--;
+    }
+}
+
+void edg_pool_trim()
+{
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool_trim_locked();
+}
+
+edg_pool_stats edg_pool_get_stats()
+{
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    return pool.stats;
+}
+
+int32_t edg_set_allocator(const edg_allocator * hooks)
+{
+    if(hooks and (!hooks->alloc or !hooks->free)) return (edgerr = "Allocator must have alloc and free."), -1;
+    
+    // pooled buffers belong to the old allocator
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool_trim_locked();
+    
+    if(!hooks)
+        allocator = {default_alloc, default_free, default_aligned_alloc, nullptr};
+    else
+        allocator = *hooks;
+    return 0;
+}
 
 // "header" must be a pointer to a block of at least ten bytes.
 // data stored in "info".
 // arguments must not be nullptr
 // undefined behavior if arguments are bogus pointers
-// Sets edgerr on negative return
+// Sets edgerr on negative return; parse_header reports the error through "error" instead
 enum {
     EDG_HEADER_API_MISUSE = -4,
     EDG_HEADER_INVALID_XORSUM = -3,
@@ -97,11 +329,11 @@ enum {
     EDG_HEADER_NOT_AN_EDG_HEADER = -1,
     EDG_HEADER_SUCCESS = 0
 };
-int edg_parse_header(const unsigned char * header, edginfo * info)
+int parse_header(const unsigned char * header, edginfo * info, const char ** error)
 {
     if(header == nullptr or info == nullptr) return EDG_HEADER_API_MISUSE;
     
-    if(memcmp(header, "EDG", 4) != 0) return (edgerr = "Not an EDG file."), EDG_HEADER_NOT_AN_EDG_HEADER;
+    if(memcmp(header, "EDG", 4) != 0) return (*error = "Not an EDG file."), EDG_HEADER_NOT_AN_EDG_HEADER;
     
     uint32_t height = *(uint32_t*)(header+4);
     uint32_t width = *(uint32_t*)(header+8);
@@ -143,9 +375,9 @@ int edg_parse_header(const unsigned char * header, edginfo * info)
     
     // Validate
     if(barrier != 0xFF)
-        return (edgerr = "Invalid barrier."), EDG_HEADER_INVALID_BARRIER;
+        return (*error = "Invalid barrier."), EDG_HEADER_INVALID_BARRIER;
     if(xorsum_check[0] != xorsum[0] or xorsum_check[1] != xorsum[1])
-        return (edgerr = "Invalid xorsrum."), EDG_HEADER_INVALID_XORSUM;
+        return (*error = "Invalid xorsrum."), EDG_HEADER_INVALID_XORSUM;
     
     info->height = height;
     info->width = width;
@@ -163,11 +395,211 @@ int edg_parse_header(const unsigned char * header, edginfo * info)
     return EDG_HEADER_SUCCESS;
 }
 
+int edg_parse_header(const unsigned char * header, edginfo * info)
+{
+    const char * error = edgerr;
+    int rcode = parse_header(header, info, &error);
+    if(rcode < 0) edgerr = error;
+    return rcode;
+}
+
 inline unsigned pixel_length(bool grayscale, bool alpha, bool format)
 {
     return ((grayscale?1:3)+(alpha?1:0))*(format?4:1);
 }
 
+// Converts "bytes" bytes of values between big and little endian, in place.
+void swap_values(unsigned char * data, uint64_t bytes, int vallength)
+{
+    if(vallength <= 1) return;
+    edg_byteswap32(data, data, bytes/4);
+}
+
+// Fills "bytes" bytes of image data with white. Must start on a value boundary.
+void fill_white(unsigned char * data, uint64_t bytes, bool format)
+{
+    if(format == 0) // 8-bit unsigned, vallength 1
+    {
+        memset(data, 255, bytes);
+        return;
+    }
+    // 32-bit float, vallength 4
+    // Store one value, then copy the filled part forward in doubling blocks. memcpy does this with the widest stores the platform has.
+    // Blocks are capped so that the source stays in cache.
+    if(bytes < 4) return;
+    const float white = 1.0f;
+    memcpy(data, &white, 4);
+    uint64_t filled = 4;
+    bytes = bytes/4*4;
+    while(filled < bytes)
+    {
+        uint64_t amount = filled;
+        if(amount > 0x10000) amount = 0x10000;
+        if(amount > bytes-filled) amount = bytes-filled;
+        memcpy(data+filled, data, amount);
+        filled += amount;
+    }
+}
+
+// Fills in the part of a truncated image that the file didn't cover, from bytes_to_read up to bytes_to_store.
+// With EDG_OPEN_VIRTUAL_WHITE, only the scanline the file ran out in is filled, and the ones after it are left to edg_row, through *white_row.
+void fill_truncated(unsigned char * data, uint64_t bytes_to_read, uint64_t bytes_to_store, uint64_t row_size, bool format, uint32_t flags, uint64_t * white_rows, unsigned char ** white_row)
+{
+    uint64_t real_end = (bytes_to_read+row_size-1)/row_size*row_size;
+    fill_white(data+bytes_to_read, real_end-bytes_to_read, format);
+    
+    *white_rows = 0;
+    *white_row = nullptr;
+    if(flags & EDG_OPEN_VIRTUAL_WHITE and real_end < bytes_to_store)
+    {
+        // if a spare scanline can't be had, just fill everything in like usual
+        *white_row = (unsigned char *)edg_allocate(row_size);
+        if(*white_row)
+        {
+            fill_white(*white_row, row_size, format);
+            *white_rows = (bytes_to_store-real_end)/row_size;
+        }
+    }
+    if(!*white_row)
+        fill_white(data+real_end, bytes_to_store-real_end, format);
+}
+
+// A file that's read with positioned reads instead of a shared cursor.
+struct random_access_file
+{
+    #if EDG_POSIX
+    int fd = -1;
+    #else
+    std::ifstream file;
+    #endif
+    
+    bool open(const char * fname)
+    {
+        #if EDG_POSIX
+        fd = ::open(fname, O_RDONLY);
+        return fd >= 0;
+        #else
+        file.open(fname, file.binary|file.in);
+        return bool(file);
+        #endif
+    }
+    
+    // Reads up to "bytes" bytes starting at "offset". Returns the number of bytes read, which is less than "bytes" only at the end of the file, or -1 on error.
+    int64_t read_at(unsigned char * buffer, uint64_t bytes, uint64_t offset)
+    {
+        uint64_t total = 0;
+        #if EDG_POSIX
+        while(total < bytes)
+        {
+            ssize_t amount = pread(fd, buffer+total, bytes-total, offset+total);
+            if(amount < 0 and errno == EINTR) continue;
+            if(amount < 0) return -1;
+            if(amount == 0) break; // end of file
+            total += amount;
+        }
+        #else
+        file.clear();
+        file.seekg(offset, file.beg);
+        if(!file) return -1;
+        file.read((char *)buffer, bytes);
+        total = file.gcount();
+        if(total < bytes and !file.eof()) return -1;
+        #endif
+        return total;
+    }
+    
+    // Returns the length of the file in bytes, or -1 on error.
+    int64_t length()
+    {
+        #if EDG_POSIX
+        struct stat st;
+        if(fstat(fd, &st) != 0) return -1;
+        return st.st_size;
+        #else
+        file.clear();
+        file.seekg(0, file.end);
+        std::streamoff length = file.tellg();
+        if(!file) return -1;
+        return length;
+        #endif
+    }
+    
+    ~random_access_file()
+    {
+        #if EDG_POSIX
+        if(fd >= 0) close(fd);
+        #endif
+    }
+};
+
+// Releases an edg's buffer according to how it's stored, leaving the metadata struct alone.
+int32_t release_data(edg * edge)
+{
+    #if EDG_POSIX
+    if(edge->storage == EDG_STORAGE_MAPPED)
+    {
+        if(munmap(edge->mapping, edge->mapping_size) != 0)
+            return (edgerr = "Failed to unmap EDG's data."), -2;
+        return 0;
+    }
+    #endif
+    if(edge->storage == EDG_STORAGE_WRAPPED)
+    {
+        if(edge->deleter) edge->deleter(edge->data, edge->userdata);
+        return 0;
+    }
+    edg_release_pixels(edge->data, edge->capacity);
+    return 0;
+}
+
+#if EDG_POSIX
+
+// Images smaller than this aren't worth starting threads for.
+const uint64_t parallel_threshold = 0x2000000;
+
+// Reads image data with positioned reads from several threads at once, byteswapping each chunk as soon as it arrives so that conversion overlaps with I/O.
+// The threads share the already open file, and are started for each call. Small images, and any chunks left over if threads can't be started, are read on the calling thread.
+bool read_parallel(random_access_file & file, unsigned char * data, uint64_t bytes, bool swap)
+{
+    const uint64_t chunk = 0x800000;
+    uint64_t chunks = (bytes+chunk-1)/chunk;
+    
+    unsigned threads = std::thread::hardware_concurrency();
+    if(threads == 0) threads = 4;
+    if(threads > chunks) threads = chunks;
+    if(bytes < parallel_threshold) threads = 1;
+    
+    std::atomic<uint64_t> next(0);
+    std::atomic<bool> failed(false);
+    auto work = [&]()
+    {
+        for(uint64_t i = next++; i < chunks and !failed; i = next++)
+        {
+            uint64_t offset = i*chunk;
+            uint64_t amount = bytes-offset < chunk ? bytes-offset : chunk;
+            if(file.read_at(data+offset, amount, 0x10+offset) != int64_t(amount))
+                failed = true;
+            else if(swap)
+                edg_byteswap32(data+offset, data+offset, amount/4);
+        }
+    };
+    
+    std::vector<std::thread> workers;
+    try
+    {
+        for(unsigned i = 1; i < threads; i++)
+            workers.emplace_back(work);
+    }
+    catch(const std::system_error &) {} // out of threads: whoever did start, and the calling thread, share the rest
+    work();
+    for(auto & worker : workers)
+        worker.join();
+    
+    return !failed;
+}
+
+#endif // EDG_POSIX
+
 /*
 1) read header
 2) determine byte length of image data
@@ -179,39 +611,65 @@ inline unsigned pixel_length(bool grayscale, bool alpha, bool format)
 8) fill in truncated image area if needed
 */
 
-edg * edg_open(const char * fname)
+int32_t edg_open_into(edg * edge, const char * fname, uint32_t flags)
 {
-    if(!fname) return (edgerr = "Filename is null"), nullptr;
-    std::ifstream file;
-    file.open(fname, file.binary|file.in);
-    if(!file) return (edgerr = "Failed to open file."), nullptr;
+    if(!edge) return (edgerr = "EDG is null"), -1;
+    if(!fname) return (edgerr = "Filename is null"), -1;
     
-    edg * edge = new (std::nothrow) edg;
-    if(!edge) return (edgerr = "Failed to allocate edg metadata structure."), nullptr;
+    // with EDG_OPEN_PARALLEL, the file is opened once and everything is read through that descriptor, which the read threads share,
+    // so the file can't be replaced between reading its header and reading its image data
+    random_access_file direct;
+    bool use_direct = EDG_POSIX and flags & EDG_OPEN_PARALLEL;
+    
+    std::ifstream file;
+    if(use_direct)
+    {
+        if(!direct.open(fname)) return (edgerr = "Failed to open file."), -2;
+    }
+    else
+    {
+        file.open(fname, file.binary|file.in);
+        if(!file) return (edgerr = "Failed to open file."), -2;
+    }
     
     // Check file length
     
     // "The type std::streamoff is a signed integral type of sufficient size to represent the maximum possible file size supported by the operating system."
     std::streamoff length;
-    // iostream exceptions are disabled by default as of C++17 and earlier
-    file.seekg(0, file.end);
-    length = -1; // streamoff is SIGNED.
-    length = file.tellg(); // streampos (arbitrary) converts to streamoff (integer type)
-    if(!file) return (edgerr = "Failed while determining file length."), nullptr;
-    if(length < 0x10) return (edgerr = "Invalid EDG file - is not long enough to contain a header, or is so long that the length counter overflowed."), nullptr;
+    if(use_direct)
+    {
+        length = direct.length();
+        if(length < 0) return (edgerr = "Failed while determining file length."), -2;
+    }
+    else
+    {
+        // iostream exceptions are disabled by default as of C++17 and earlier
+        file.seekg(0, file.end);
+        length = -1; // streamoff is SIGNED.
+        length = file.tellg(); // streampos (arbitrary) converts to streamoff (integer type)
+        if(!file) return (edgerr = "Failed while determining file length."), -2;
+    }
+    if(length < 0x10) return (edgerr = "Invalid EDG file - is not long enough to contain a header, or is so long that the length counter overflowed."), -3;
     
     uint64_t imagebytes = length-0x10;
     
     // Get info
     
-    file.seekg(0, file.beg);
     unsigned char header[0x10];
-    file.read((char *)header, 0x10);
-    if(!file) return (edgerr = "Failed to read header from file."), nullptr;
+    if(use_direct)
+    {
+        if(direct.read_at(header, 0x10, 0) != 0x10) return (edgerr = "Failed to read header from file."), -2;
+    }
+    else
+    {
+        file.seekg(0, file.beg);
+        file.read((char *)header, 0x10);
+        if(!file) return (edgerr = "Failed to read header from file."), -2;
+    }
     
     edginfo info;
     int rcode = edg_parse_header(header, &info);
-    if(rcode < 0) return nullptr; // edgerr already set by edg_parse_header
+    if(rcode < 0) return -3; // edgerr already set by edg_parse_header
     
     // Bytes per full pixel
     unsigned pixelsize = pixel_length(info.grayscale, info.alpha, info.format);
@@ -228,7 +686,7 @@ edg * edg_open(const char * fname)
         // truncated: use stream information
         bytes_to_read = uint64_t(imagebytes);
         if(bytes_to_read != imagebytes) // might happen due to signed-unsigned conversion oddities or if streamoff is larger than uint64_t
-            return (edgerr = "Can't load EDG file - file length somehow failed to convert to unsigned size. File may be too large to be supported, or platform is bugged."), nullptr;
+            return (edgerr = "Can't load EDG file - file length somehow failed to convert to unsigned size. File may be too large to be supported, or platform is bugged."), -3;
         // cut off any incomplete pixel that may be at the end of the image data
         bytes_to_read = (bytes_to_read/pixelsize)*pixelsize;
     }
@@ -241,210 +699,1084 @@ edg * edg_open(const char * fname)
     // If size was limited in any way (like overflow, which might happen), this division will truncate to lower than pixelsize
     
     if(bytes_to_store/pixels_wide/pixels_tall != pixelsize)
-        return (edgerr = "Can't load EDG file - image data contains too many byte values to address in 64-bit space."), nullptr;
+        return (edgerr = "Can't load EDG file - image data contains too many byte values to address in 64-bit space."), -3;
     if(uint64_t(size_t(bytes_to_store)) != bytes_to_store)
-        return (edgerr = "Can't load EDG file - image data too large to fit into size_t."), nullptr;
+        return (edgerr = "Can't load EDG file - image data too large to fit into size_t."), -3;
     
     
     if (bytes_to_read > bytes_to_store)
-        return (edgerr = "Something went wrong. We need to read more bytes than we store. This is a bug. Please report it."), nullptr;
+        return (edgerr = "Something went wrong. We need to read more bytes than we store. This is a bug. Please report it."), -3;
     
-    // allocate buffer and defer free
+    // reuse the edg's buffer if it's big enough, otherwise allocate a new one and defer free
     
-    unsigned char * data = (unsigned char *)malloc(bytes_to_store);
-    if (!data) return (edgerr = "Failed to allocate memory for buffer. If it's a large image, use a stream."), nullptr;
+    bool reuse = edge->data and edge->storage != EDG_STORAGE_MAPPED and edge->capacity >= bytes_to_store;
+    uint64_t capacity = edge->capacity;
+    unsigned char * data = reuse ? edge->data : edg_allocate_pixels(bytes_to_store, &capacity, false);
+    if (!data) return (edgerr = "Failed to allocate memory for buffer. If it's a large image, use a stream."), -4;
     
     defer data_free
-    ([data](){
-        free(data);
+    ([data, reuse, capacity](){
+        if(!reuse) edg_release_pixels(data, capacity);
     });
     
-    // copy image data into RAM
-    
-    file.seekg(0x10, file.beg);
-    if(!file) return (edgerr = "Failed to return to beginning of file to read data into RAM."), nullptr;
-    
-    file.read((char *)data, bytes_to_read);
-    if(!file) return (edgerr = "Failed to read image data into RAM."), nullptr;
-    
-    file.close();
-    
-    // byteswap to native if needed
+    // copy image data into RAM, byteswapping to native if needed
     
     int vallength = info.format?4:1;
-    int values = (info.grayscale?1:3)+info.alpha;
+    bool swap = info.endian != HAVE_LITTLE_ENDIAN_PLATFORM and vallength > 1;
     
-    if(info.endian != HAVE_LITTLE_ENDIAN_PLATFORM)
+    #if EDG_POSIX
+    if(use_direct)
     {
-        for(uint64_t i = 0; i < bytes_to_read/values; i++)
-            reverse(&data[i*vallength], vallength);
+        if(!read_parallel(direct, data, bytes_to_read, swap))
+            return (edgerr = "Failed to read image data into RAM."), -2;
+        swap = false; // already done
     }
+    else
+    #endif
+    {
+        file.seekg(0x10, file.beg);
+        if(!file) return (edgerr = "Failed to return to beginning of file to read data into RAM."), -2;
+        
+        file.read((char *)data, bytes_to_read);
+        if(!file) return (edgerr = "Failed to read image data into RAM."), -2;
+        
+        file.close();
+    }
+    
+    if(swap)
+        swap_values(data, bytes_to_read, vallength);
     
     info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
     
     // fill in truncated values
+    // with EDG_OPEN_VIRTUAL_WHITE, only the scanline the file ran out in is filled, and the ones after it are served by edg_row
     
+    uint64_t white_rows = 0;
+    unsigned char * white_row = nullptr;
     if(truncated)
+        fill_truncated(data, bytes_to_read, bytes_to_store, pixels_wide*pixelsize, info.format, flags, &white_rows, &white_row);
+    
+    // swap the new buffer into the edg
+    
+    if(!reuse)
     {
-        for(uint64_t i = bytes_to_read/vallength; i < bytes_to_store/vallength; i += 1)
-        {
-            if(info.format == 0) // 8-bit unsigned, vallength 1
-                data[i] = 255;
-            if(info.format == 1) // 32-bit float, vallength 4
-                ((float*)(data))[i] = 1.0f;
-        }
+        if(edge->data) release_data(edge);
+        edge->data = data;
+        edge->capacity = capacity;
+        edge->storage = EDG_STORAGE_MALLOC;
+        edge->mapping = nullptr;
+        edge->mapping_size = 0;
+        edge->deleter = nullptr;
+        edge->userdata = nullptr;
     }
     
-    // build edg* and return it
+    edg_deallocate(edge->white_row);
     
     edge->info = info;
     edge->size = bytes_to_store;
-    edge->data = data;
+    edge->white_rows = white_rows;
+    edge->white_row = white_row;
     
     // cancel defer before returning
     
     data_free.deferred = [](){};
     
+    return 0;
+}
+
+edg * edg_open(const char * fname, uint32_t flags)
+{
+    edg * edge = edg_new<edg>();
+    if(!edge) return (edgerr = "Failed to allocate edg metadata structure."), nullptr;
+    edge->data = nullptr;
+    edge->size = 0;
+    
+    if(edg_open_into(edge, fname, flags) < 0)
+        return edg_delete(edge), nullptr; // edgerr already set by edg_open_into
+    
     return edge;
 }
 
+const unsigned char * edg_row(const edg * edge, uint64_t y)
+{
+    uint64_t rows = uint64_t(edge->info.height)+1;
+    if(y >= rows-edge->white_rows) return edge->white_row;
+    return edge->data + y*(edge->size/rows);
+}
+
+int32_t edg_materialize(edg * edge)
+{
+    if(!edge) return (edgerr = "EDG is null"), -1;
+    if(edge->white_rows == 0) return 0;
+    if(edge->capacity == 0) return (edgerr = "EDG's data is borrowed and read-only."), -2;
+    
+    uint64_t rows = uint64_t(edge->info.height)+1;
+    uint64_t white_bytes = edge->white_rows*(edge->size/rows);
+    fill_white(edge->data+edge->size-white_bytes, white_bytes, edge->info.format);
+    
+    edg_deallocate(edge->white_row);
+    edge->white_row = nullptr;
+    edge->white_rows = 0;
+    
+    return 0;
+}
+
 /*
-1) turn arguments into info struct
-2) allocate edg metadata struct
-3) check buffer size
-4) allocate buffer
-5) fill buffer with white
-6) hook buffer and info into metadata struct
-7) return metadata struct
+1) map the whole file
+2) read header out of the mapping
+3) fall back to edg_open if the file is truncated or foreign endian, since those need a writable copy
+4) point data at the image data inside the mapping
 */
 
-edg * edg_make(uint32_t height, uint32_t width, bool format, bool grayscale, bool alpha)
+edg * edg_open_mapped(const char * fname)
 {
+    if(!fname) return (edgerr = "Filename is null"), nullptr;
+    
+    #if EDG_POSIX
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0) return (edgerr = "Failed to open file."), nullptr;
+    
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+        return close(fd), (edgerr = "Failed while determining file length."), nullptr;
+    if(st.st_size < 0x10)
+        return close(fd), (edgerr = "Invalid EDG file - is not long enough to contain a header, or is so long that the length counter overflowed."), nullptr;
+    
+    uint64_t length = st.st_size;
+    if(uint64_t(size_t(length)) != length)
+        return close(fd), edg_open(fname);
+    
+    // private and writable: pages are shared with the page cache until written to, and writes never reach the file
+    void * mapping = mmap(nullptr, length, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if(mapping == MAP_FAILED) return edg_open(fname);
+    
+    defer mapping_free
+    ([mapping, length](){
+        munmap(mapping, length);
+    });
+    
     edginfo info;
-    info.height = height;
-    info.width = width;
-    info.format = format;
-    info.grayscale = grayscale;
-    info.alpha = alpha;
-    info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
-    info.tileup = false;
-    info.tiledown = false;
-    info.tileleft = false;
-    info.tileright = false;
-    edg * edge = new (std::nothrow) edg;
-    if(!edge) return (edgerr = "Failed to allocate edg metadata structure."), nullptr;
+    int rcode = edg_parse_header((const unsigned char *)mapping, &info);
+    if(rcode < 0) return nullptr; // edgerr already set by edg_parse_header
     
-    // Bytes per full pixel
     unsigned pixelsize = pixel_length(info.grayscale, info.alpha, info.format);
     uint64_t pixels_tall = uint64_t(info.height)+1;
     uint64_t pixels_wide = uint64_t(info.width)+1;
     uint64_t bytes_to_store = pixels_wide*pixels_tall*pixelsize;
     
-    // If size was limited in any way (like overflow, which might happen), this division will truncate to lower than pixelsize
-    
     if(bytes_to_store/pixels_wide/pixels_tall != pixelsize)
-        return (edgerr = "Can't make EDG file - image data contains too many byte values to address in 64-bit space."), nullptr;
-    if(uint64_t(size_t(bytes_to_store)) != bytes_to_store)
-        return (edgerr = "Can't make EDG file - image data too large to fit into size_t."), nullptr;
-    
-    // allocate buffer and defer free
-    
-    unsigned char * data = (unsigned char *)malloc(bytes_to_store);
-    if (!data) return (edgerr = "Failed to allocate memory for buffer. If it's a large image, use a stream."), nullptr;
-    
-    int vallength = info.format?4:1;
+        return (edgerr = "Can't load EDG file - image data contains too many byte values to address in 64-bit space."), nullptr;
     
-    // fill allocated pixels with white
-    for(uint64_t i = 0; i < bytes_to_store/vallength; i += 1)
-    {
-        if(info.format == 0) // 8-bit unsigned, vallength 1
-            data[i] = 255;
-        if(info.format == 1) // 32-bit float, vallength 4
-            ((float*)(data))[i] = 1.0f;
-    }
+    // truncated and foreign-endian files can't be used in place; 8-bit files have no endian to swap
+    bool native = info.endian == HAVE_LITTLE_ENDIAN_PLATFORM or !info.format;
+    if(length-0x10 < bytes_to_store or !native)
+        return edg_open(fname);
+    info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
     
-    // build edg* and return it
+    edg * edge = edg_new<edg>();
+    if(!edge) return (edgerr = "Failed to allocate edg metadata structure."), nullptr;
     
     edge->info = info;
     edge->size = bytes_to_store;
-    edge->data = data;
+    edge->data = (unsigned char *)mapping + 0x10;
+    edge->capacity = bytes_to_store;
+    edge->storage = EDG_STORAGE_MAPPED;
+    edge->mapping = mapping;
+    edge->mapping_size = length;
+    
+    mapping_free.deferred = [](){};
     
     return edge;
+    #else
+    return edg_open(fname);
+    #endif
 }
 
-int32_t edg_save(edg * edge, const char * fname)
+/*
+1) read header
+2) check that the region is inside the image
+3) allocate buffer
+4) read each scanline of the region with its own positioned read, stopping once the file runs out
+5) byteswap what was read and fill in the rest with white
+*/
+
+edg * edg_open_region(const char * fname, uint32_t y, uint32_t x, uint32_t height, uint32_t width)
 {
-    if(!edge) return (edgerr = "EDG is null"), -1;
-    if(!edge->data) return (edgerr = "EDG's data is null"), -1;
-    if(!fname) return (edgerr = "Filename is null"), -1;
+    if(!fname) return (edgerr = "Filename is null"), nullptr;
     
-    std::ofstream file;
-    file.open(fname, file.out|file.binary);
-    if(!file) return (edgerr = "Failed to open file."), -2;
+    random_access_file file;
+    if(!file.open(fname)) return (edgerr = "Failed to open file."), nullptr;
     
-    // write header
+    unsigned char header[0x10];
+    if(file.read_at(header, 0x10, 0) != 0x10) return (edgerr = "Failed to read header from file."), nullptr;
+    
+    edginfo info;
+    int rcode = edg_parse_header(header, &info);
+    if(rcode < 0) return nullptr; // edgerr already set by edg_parse_header
+    
+    if(uint64_t(y)+height > info.height or uint64_t(x)+width > info.width)
+        return (edgerr = "Region does not fit inside the image."), nullptr;
+    
+    unsigned pixelsize = pixel_length(info.grayscale, info.alpha, info.format);
+    uint64_t pixels_tall = uint64_t(info.height)+1;
+    uint64_t pixels_wide = uint64_t(info.width)+1;
+    uint64_t bytes_in_file = pixels_wide*pixels_tall*pixelsize;
+    
+    if(bytes_in_file/pixels_wide/pixels_tall != pixelsize)
+        return (edgerr = "Can't load EDG file - image data contains too many byte values to address in 64-bit space."), nullptr;
+    
+    // the region is no bigger than the image, so this can't overflow
+    uint64_t row_bytes = (uint64_t(width)+1)*pixelsize;
+    uint64_t bytes_to_store = row_bytes*(uint64_t(height)+1);
+    if(uint64_t(size_t(bytes_to_store)) != bytes_to_store)
+        return (edgerr = "Can't load EDG region - image data too large to fit into size_t."), nullptr;
+    
+    uint64_t capacity;
+    unsigned char * data = edg_allocate_pixels(bytes_to_store, &capacity, false);
+    if (!data) return (edgerr = "Failed to allocate memory for buffer."), nullptr;
+    
+    defer data_free
+    ([data, capacity](){
+        edg_release_pixels(data, capacity);
+    });
+    
+    bool truncated = false;
+    for(uint64_t row = 0; row <= height; row++)
+    {
+        unsigned char * dest = data + row*row_bytes;
+        uint64_t bytes_read = 0;
+        if(!truncated)
+        {
+            uint64_t offset = 0x10 + ((y+row)*pixels_wide + x)*pixelsize;
+            int64_t amount = file.read_at(dest, row_bytes, offset);
+            if(amount < 0) return (edgerr = "Failed to read image data into RAM."), nullptr;
+            // cut off any incomplete pixel; rows always start on a pixel boundary
+            bytes_read = (uint64_t(amount)/pixelsize)*pixelsize;
+            truncated = bytes_read < row_bytes;
+        }
+        if(info.endian != HAVE_LITTLE_ENDIAN_PLATFORM)
+            swap_values(dest, bytes_read, info.format?4:1);
+        if(bytes_read < row_bytes)
+            fill_white(dest+bytes_read, row_bytes-bytes_read, info.format);
+    }
+    
+    edg * edge = edg_new<edg>();
+    if(!edge) return (edgerr = "Failed to allocate edg metadata structure."), nullptr;
+    
+    // the region only shares the edges of the image that it touches
+    edginfo region = info;
+    region.height = height;
+    region.width = width;
+    region.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
+    region.tileup    = info.tileup    and y == 0;
+    region.tiledown  = info.tiledown  and uint64_t(y)+height == info.height;
+    region.tileleft  = info.tileleft  and x == 0;
+    region.tileright = info.tileright and uint64_t(x)+width == info.width;
+    
+    edge->info = region;
+    edge->size = bytes_to_store;
+    edge->data = data;
+    edge->capacity = capacity;
+    
+    data_free.deferred = [](){};
+    
+    return edge;
+}
+
+// Probes a file, reporting errors through "error" instead of edgerr so that edg_probe_batch can give each file its own.
+int32_t probe_file(const char * fname, edginfo * info, uint64_t * file_length, const char ** error)
+{
+    if(!fname) return (*error = "Filename is null"), -1;
+    if(!info) return (*error = "Info is null"), -1;
+    
+    random_access_file file;
+    if(!file.open(fname)) return (*error = "Failed to open file."), -2;
+    
+    int64_t length = file.length();
+    if(length < 0) return (*error = "Failed while determining file length."), -2;
+    if(length < 0x10) return (*error = "Invalid EDG file - is not long enough to contain a header."), -3;
+    
+    unsigned char header[0x10];
+    if(file.read_at(header, 0x10, 0) != 0x10) return (*error = "Failed to read header from file."), -2;
+    
+    if(parse_header(header, info, error) < 0) return -3;
+    
+    if(file_length) *file_length = length;
+    
+    unsigned pixelsize = pixel_length(info->grayscale, info->alpha, info->format);
+    uint64_t pixels_tall = uint64_t(info->height)+1;
+    uint64_t pixels_wide = uint64_t(info->width)+1;
+    uint64_t bytes_to_store = pixels_wide*pixels_tall*pixelsize;
+    
+    // an image too big to address is always truncated
+    if(bytes_to_store/pixels_wide/pixels_tall != pixelsize)
+        return EDG_PROBE_TRUNCATED;
+    
+    uint64_t imagebytes = length-0x10;
+    if(imagebytes < bytes_to_store) return EDG_PROBE_TRUNCATED;
+    if(imagebytes > bytes_to_store) return EDG_PROBE_PADDED;
+    return 0;
+}
+
+int32_t edg_probe(const char * fname, edginfo * info, uint64_t * file_length)
+{
+    const char * error = edgerr;
+    int32_t rcode = probe_file(fname, info, file_length, &error);
+    if(rcode < 0) edgerr = error;
+    return rcode;
+}
+
+void edg_probe_batch(const char * const * fnames, uint64_t count, edg_probe_result * results, unsigned threads)
+{
+    if(threads == 0) threads = 16; // probing is bound by syscall latency, not cores
+    if(threads > count) threads = count;
+    
+    std::atomic<uint64_t> next(0);
+    auto work = [&]()
+    {
+        for(uint64_t i = next++; i < count; i = next++)
+        {
+            edg_probe_result & result = results[i];
+            result.error = "";
+            result.file_length = 0;
+            result.status = probe_file(fnames[i], &result.info, &result.file_length, &result.error);
+        }
+    };
+    
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < threads; i++)
+        workers.emplace_back(work);
+    work(); // the calling thread pulls its own weight
+    for(auto & worker : workers)
+        worker.join();
+}
+
+/*
+1) read header
+2) determine byte length of image data, and whether the span is truncated
+3) if a view was asked for and the data can be used as is, point into the span
+4) otherwise allocate a buffer and copy, byteswapping on the way
+5) fill in truncated image area if needed
+*/
+
+edg * edg_decode_mem(const unsigned char * bytes, uint64_t length, uint32_t flags)
+{
+    if(!bytes) return (edgerr = "Data is null"), nullptr;
+    if(length < 0x10) return (edgerr = "Invalid EDG data - is not long enough to contain a header."), nullptr;
+    
+    edginfo info;
+    int rcode = edg_parse_header(bytes, &info);
+    if(rcode < 0) return nullptr; // edgerr already set by edg_parse_header
+    
+    unsigned pixelsize = pixel_length(info.grayscale, info.alpha, info.format);
+    uint64_t pixels_tall = uint64_t(info.height)+1;
+    uint64_t pixels_wide = uint64_t(info.width)+1;
+    uint64_t bytes_to_store = pixels_wide*pixels_tall*pixelsize;
+    
+    if(bytes_to_store/pixels_wide/pixels_tall != pixelsize)
+        return (edgerr = "Can't decode EDG data - image data contains too many byte values to address in 64-bit space."), nullptr;
+    if(uint64_t(size_t(bytes_to_store)) != bytes_to_store)
+        return (edgerr = "Can't decode EDG data - image data too large to fit into size_t."), nullptr;
+    
+    uint64_t imagebytes = length-0x10;
+    bool truncated = imagebytes < bytes_to_store;
+    // cut off any incomplete pixel that may be at the end of the image data
+    uint64_t bytes_to_read = truncated ? (imagebytes/pixelsize)*pixelsize : bytes_to_store;
+    
+    bool native = info.endian == HAVE_LITTLE_ENDIAN_PLATFORM or !info.format;
+    info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
+    
+    if(flags & EDG_DECODE_VIEW and native and !truncated and uintptr_t(bytes+0x10) % (info.format?4:1) == 0)
+    {
+        edg * edge = edg_wrap(&info, (unsigned char *)bytes+0x10, bytes_to_store, nullptr);
+        // the span is read-only: no capacity, so edg_open_into never reuses it and edg_materialize never writes to it
+        if(edge) edge->capacity = 0;
+        return edge;
+    }
+    
+    uint64_t capacity;
+    unsigned char * data = edg_allocate_pixels(bytes_to_store, &capacity, false);
+    if (!data) return (edgerr = "Failed to allocate memory for buffer."), nullptr;
+    
+    edg * edge = edg_new<edg>();
+    if(!edge) return edg_release_pixels(data, capacity), (edgerr = "Failed to allocate edg metadata structure."), nullptr;
+    
+    if(native)
+        memcpy(data, bytes+0x10, bytes_to_read);
+    else
+        edg_byteswap32(data, bytes+0x10, bytes_to_read/4);
+    
+    if(truncated)
+        fill_white(data+bytes_to_read, bytes_to_store-bytes_to_read, info.format);
+    
+    edge->info = info;
+    edge->size = bytes_to_store;
+    edge->data = data;
+    edge->capacity = capacity;
+    
+    return edge;
+}
+
+struct edg_reader
+{
+    std::ifstream file; // only used if the reader opened the file itself
+    std::istream * stream;
+    edginfo info; // endian is the file's endian, not native
+    unsigned pixelsize;
+    uint64_t row_size;
+    uint64_t next_row; // index of the next scanline to hand out
+    bool truncated; // set once the file runs out; everything from then on is white
+};
+
+// Reads and parses the header from the reader's stream. Only ever reads forwards, so it works on pipes.
+bool reader_start(edg_reader * reader)
+{
+    unsigned char header[0x10];
+    reader->stream->read((char *)header, 0x10);
+    if(!*reader->stream) return (edgerr = "Failed to read header from file."), false;
+    
+    int rcode = edg_parse_header(header, &reader->info);
+    if(rcode < 0) return false; // edgerr already set by edg_parse_header
+    
+    reader->pixelsize = pixel_length(reader->info.grayscale, reader->info.alpha, reader->info.format);
+    reader->row_size = (uint64_t(reader->info.width)+1)*reader->pixelsize;
+    reader->next_row = 0;
+    reader->truncated = false;
+    
+    if(uint64_t(size_t(reader->row_size)) != reader->row_size)
+        return (edgerr = "Can't stream EDG file - scanline too large to fit into size_t."), false;
+    
+    return true;
+}
+
+edg_reader * edg_reader_open(const char * fname)
+{
+    if(!fname) return (edgerr = "Filename is null"), nullptr;
+    
+    edg_reader * reader = edg_new<edg_reader>();
+    if(!reader) return (edgerr = "Failed to allocate edg reader."), nullptr;
+    
+    defer reader_free
+    ([reader](){
+        edg_delete(reader);
+    });
+    
+    reader->file.open(fname, std::ios::binary|std::ios::in);
+    if(!reader->file) return (edgerr = "Failed to open file."), nullptr;
+    reader->stream = &reader->file;
+    
+    if(!reader_start(reader)) return nullptr;
+    
+    reader_free.deferred = [](){};
+    
+    return reader;
+}
+
+edg_reader * edg_reader_open_stream(std::istream & stream)
+{
+    edg_reader * reader = edg_new<edg_reader>();
+    if(!reader) return (edgerr = "Failed to allocate edg reader."), nullptr;
+    
+    reader->stream = &stream;
+    if(!reader_start(reader)) return edg_delete(reader), nullptr;
+    
+    return reader;
+}
+
+edginfo edg_reader_info(edg_reader * reader)
+{
+    edginfo info = reader->info;
+    info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
+    return info;
+}
+
+uint64_t edg_reader_row_size(edg_reader * reader)
+{
+    return reader->row_size;
+}
+
+/*
+1) clip request to the rows left in the image
+2) read as much of it as the file has
+3) cut off any incomplete pixel and byteswap what's left
+4) fill in the rest with white
+*/
+
+int64_t edg_reader_read(edg_reader * reader, unsigned char * buffer, uint64_t rows)
+{
+    if(!reader) return (edgerr = "Reader is null"), -1;
+    if(!buffer) return (edgerr = "Buffer is null"), -1;
+    
+    uint64_t rows_left = uint64_t(reader->info.height)+1-reader->next_row;
+    if(rows > rows_left) rows = rows_left;
+    if(rows == 0) return 0;
+    if(rows > SIZE_MAX/reader->row_size or rows > uint64_t(INT64_MAX))
+        return (edgerr = "Too many scanlines requested at once."), -1;
+    
+    uint64_t bytes = rows*reader->row_size;
+    uint64_t bytes_read = 0;
+    
+    if(!reader->truncated)
+    {
+        reader->stream->read((char *)buffer, bytes);
+        bytes_read = reader->stream->gcount();
+        if(bytes_read < bytes)
+        {
+            if(!reader->stream->eof()) return (edgerr = "Failed to read image data from file."), -2;
+            reader->truncated = true;
+            bytes_read = (bytes_read/reader->pixelsize)*reader->pixelsize;
+        }
+    }
+    
+    if(reader->info.endian != HAVE_LITTLE_ENDIAN_PLATFORM)
+        swap_values(buffer, bytes_read, reader->info.format?4:1);
+    
+    if(bytes_read < bytes)
+        fill_white(buffer+bytes_read, bytes-bytes_read, reader->info.format);
+    
+    reader->next_row += rows;
+    
+    return rows;
+}
+
+int32_t edg_reader_close(edg_reader * reader)
+{
+    if(!reader) return (edgerr = "Reader is null"), -1;
+    edg_delete(reader);
+    return 0;
+}
+
+/*
+1) read header
+2) allocate buffer
+3) read exactly as much image data as the header implies, treating an early end of stream as truncation
+4) read and throw away any padding, so that whatever is writing to the stream doesn't get cut off
+*/
+
+edg * edg_open_stream(std::istream & stream)
+{
+    edg_reader reader;
+    reader.stream = &stream;
+    if(!reader_start(&reader)) return nullptr;
+    
+    uint64_t pixels_tall = uint64_t(reader.info.height)+1;
+    uint64_t bytes_to_store = reader.row_size*pixels_tall;
+    
+    if(bytes_to_store/pixels_tall != reader.row_size)
+        return (edgerr = "Can't load EDG file - image data contains too many byte values to address in 64-bit space."), nullptr;
+    if(uint64_t(size_t(bytes_to_store)) != bytes_to_store)
+        return (edgerr = "Can't load EDG file - image data too large to fit into size_t."), nullptr;
+    
+    uint64_t capacity;
+    unsigned char * data = edg_allocate_pixels(bytes_to_store, &capacity, false);
+    if (!data) return (edgerr = "Failed to allocate memory for buffer. If it's a large image, use edg_reader_open_stream."), nullptr;
+    
+    defer data_free
+    ([data, capacity](){
+        edg_release_pixels(data, capacity);
+    });
+    
+    if(edg_reader_read(&reader, data, pixels_tall) < 0) return nullptr; // edgerr already set by edg_reader_read
+    
+    if(!reader.truncated)
+        stream.ignore(std::numeric_limits<std::streamsize>::max());
+    
+    edg * edge = edg_new<edg>();
+    if(!edge) return (edgerr = "Failed to allocate edg metadata structure."), nullptr;
+    
+    edge->info = edg_reader_info(&reader);
+    edge->size = bytes_to_store;
+    edge->data = data;
+    edge->capacity = capacity;
+    
+    data_free.deferred = [](){};
+    
+    return edge;
+}
+
+/*
+1) turn arguments into info struct
+2) allocate edg metadata struct
+3) check buffer size
+4) allocate buffer
+5) fill buffer with white
+6) hook buffer and info into metadata struct
+7) return metadata struct
+*/
+
+edg * edg_make(uint32_t height, uint32_t width, bool format, bool grayscale, bool alpha, int fill)
+{
+    if(fill != EDG_FILL_WHITE and fill != EDG_FILL_ZERO and fill != EDG_FILL_UNINITIALIZED)
+        return (edgerr = "Unknown fill policy."), nullptr;
+    
+    edginfo info;
+    info.height = height;
+    info.width = width;
+    info.format = format;
+    info.grayscale = grayscale;
+    info.alpha = alpha;
+    info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
+    info.tileup = false;
+    info.tiledown = false;
+    info.tileleft = false;
+    info.tileright = false;
+    // Bytes per full pixel
+    unsigned pixelsize = pixel_length(info.grayscale, info.alpha, info.format);
+    uint64_t pixels_tall = uint64_t(info.height)+1;
+    uint64_t pixels_wide = uint64_t(info.width)+1;
+    uint64_t bytes_to_store = pixels_wide*pixels_tall*pixelsize;
+    
+    // If size was limited in any way (like overflow, which might happen), this division will truncate to lower than pixelsize
+    
+    if(bytes_to_store/pixels_wide/pixels_tall != pixelsize)
+        return (edgerr = "Can't make EDG file - image data contains too many byte values to address in 64-bit space."), nullptr;
+    if(uint64_t(size_t(bytes_to_store)) != bytes_to_store)
+        return (edgerr = "Can't make EDG file - image data too large to fit into size_t."), nullptr;
+    
+    // allocate buffer and metadata
+    
+    uint64_t capacity;
+    unsigned char * data = edg_allocate_pixels(bytes_to_store, &capacity, fill == EDG_FILL_ZERO);
+    if (!data) return (edgerr = "Failed to allocate memory for buffer. If it's a large image, use a stream."), nullptr;
+    
+    edg * edge = edg_new<edg>();
+    if(!edge) return edg_release_pixels(data, capacity), (edgerr = "Failed to allocate edg metadata structure."), nullptr;
+    
+    if(fill == EDG_FILL_WHITE)
+        fill_white(data, bytes_to_store, info.format);
+    
+    // build edg* and return it
     
-    file.write((const char *)"EDG", 4);
-    if(!file) return (edgerr = "Failed to write magic to file."), -3;
+    edge->info = info;
+    edge->size = bytes_to_store;
+    edge->data = data;
+    edge->capacity = capacity;
     
+    return edge;
+}
+
+// Number of bytes of data that get saved.
+// Virtual white scanlines are left off, which leaves the file truncated at the same point, and so decodes to the same image.
+uint64_t stored_bytes(const edg * edge)
+{
+    return edge->size - edge->white_rows*(edge->size/(uint64_t(edge->info.height)+1));
+}
+
+// Builds the 16-byte header for an image, with dimensions in info's endian.
+// "header" must be a pointer to a block of at least sixteen bytes.
+void build_header(const edginfo & info, unsigned char * header)
+{
     // height/width are always native endian in memory
-    if(edge->info.endian != HAVE_LITTLE_ENDIAN_PLATFORM)
+    uint32_t height = info.height;
+    uint32_t width = info.width;
+    if(info.endian != HAVE_LITTLE_ENDIAN_PLATFORM)
     {
-        reverse((unsigned char *)&edge->info.height, 4);
-        reverse((unsigned char *)&edge->info.width, 4);
+        reverse((unsigned char *)&height, 4);
+        reverse((unsigned char *)&width, 4);
     }
-    file.write((const char *)&edge->info.height, 4);
-    file.write((const char *)&edge->info.width, 4);
     
-    file.put((char)(0xFF)); // barrier
+    memcpy(header, "EDG", 4);
+    memcpy(header+4, &height, 4);
+    memcpy(header+8, &width, 4);
+    
+    header[12] = 0xFF; // barrier
     
     unsigned char flags = 0;
-    if(edge->info.format)    flags |= 0b1000'0000;
-    if(edge->info.grayscale) flags |= 0b0100'0000;
-    if(edge->info.alpha)     flags |= 0b0010'0000;
-    if(edge->info.endian)    flags |= 0b0001'0000;
-    if(edge->info.tileup)    flags |= 0b0000'1000;
-    if(edge->info.tiledown)  flags |= 0b0000'0100;
-    if(edge->info.tileleft)  flags |= 0b0000'0010;
-    if(edge->info.tileright) flags |= 0b0000'0001;
-    file.put((char)flags);
+    if(info.format)    flags |= 0b1000'0000;
+    if(info.grayscale) flags |= 0b0100'0000;
+    if(info.alpha)     flags |= 0b0010'0000;
+    if(info.endian)    flags |= 0b0001'0000;
+    if(info.tileup)    flags |= 0b0000'1000;
+    if(info.tiledown)  flags |= 0b0000'0100;
+    if(info.tileleft)  flags |= 0b0000'0010;
+    if(info.tileright) flags |= 0b0000'0001;
+    header[13] = flags;
     
     unsigned char xor1 = 0;
     unsigned char xor2 = 0;
+    for(auto i = 0; i < 7; i++)
+    {
+        xor1 ^= header[i*2];
+        xor2 ^= header[i*2+1];
+    }
+    header[14] = xor1;
+    header[15] = xor2;
+}
+
+// Writes native endian image data to a file in info's endian. Foreign endian data is converted a chunk at a time, so the caller's buffer is never modified.
+bool write_values(std::ostream & file, const unsigned char * data, uint64_t bytes, const edginfo & info)
+{
+    if(info.endian == HAVE_LITTLE_ENDIAN_PLATFORM or !info.format)
+    {
+        file.write((const char *)data, bytes);
+        return bool(file);
+    }
+    
+    unsigned char chunk[0x10000];
+    while(bytes > 0)
+    {
+        uint64_t amount = bytes < sizeof(chunk) ? bytes : sizeof(chunk);
+        edg_byteswap32(chunk, data, amount/4);
+        file.write((const char *)chunk, amount);
+        if(!file) return false;
+        data += amount;
+        bytes -= amount;
+    }
+    return true;
+}
+
+/*
+1) size the file to fit the header and image data
+2) map the whole file, shared so that writes go to the file
+3) write the header into the mapping
+4) point data just past the header
+*/
+
+edg * edg_create_mapped(const char * fname, uint32_t height, uint32_t width, bool format, bool grayscale, bool alpha, int fill)
+{
+    if(!fname) return (edgerr = "Filename is null"), nullptr;
+    if(fill != EDG_FILL_WHITE and fill != EDG_FILL_ZERO and fill != EDG_FILL_UNINITIALIZED)
+        return (edgerr = "Unknown fill policy."), nullptr;
+    
+    #if EDG_POSIX
+    edginfo info;
+    info.height = height;
+    info.width = width;
+    info.format = format;
+    info.grayscale = grayscale;
+    info.alpha = alpha;
+    info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
+    info.tileup = false;
+    info.tiledown = false;
+    info.tileleft = false;
+    info.tileright = false;
+    
+    unsigned pixelsize = pixel_length(info.grayscale, info.alpha, info.format);
+    uint64_t pixels_tall = uint64_t(info.height)+1;
+    uint64_t pixels_wide = uint64_t(info.width)+1;
+    uint64_t bytes_to_store = pixels_wide*pixels_tall*pixelsize;
+    
+    if(bytes_to_store/pixels_wide/pixels_tall != pixelsize or bytes_to_store > UINT64_MAX-0x10)
+        return (edgerr = "Can't make EDG file - image data contains too many byte values to address in 64-bit space."), nullptr;
+    uint64_t length = bytes_to_store+0x10;
+    if(uint64_t(size_t(length)) != length or uint64_t(off_t(length)) != length)
+        return (edgerr = "Can't make EDG file - file too large to map."), nullptr;
+    
+    int fd = open(fname, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    if(fd < 0) return (edgerr = "Failed to open file."), nullptr;
+    
+    if(ftruncate(fd, length) != 0)
+        return close(fd), (edgerr = "Failed to size file."), nullptr;
+    
+    void * mapping = mmap(nullptr, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if(mapping == MAP_FAILED) return (edgerr = "Failed to map file into memory."), nullptr;
+    
+    edg * edge = edg_new<edg>();
+    if(!edge) return munmap(mapping, length), (edgerr = "Failed to allocate edg metadata structure."), nullptr;
+    
+    build_header(info, (unsigned char *)mapping);
     
-    xor1 ^= 'E';
-    xor2 ^= 'D';
+    edge->info = info;
+    edge->size = bytes_to_store;
+    edge->data = (unsigned char *)mapping + 0x10;
+    edge->capacity = bytes_to_store;
+    edge->storage = EDG_STORAGE_MAPPED;
+    edge->mapping = mapping;
+    edge->mapping_size = length;
+    
+    if(fill == EDG_FILL_WHITE)
+        fill_white(edge->data, bytes_to_store, info.format);
+    
+    return edge;
+    #else
+    (void)height; (void)width; (void)format; (void)grayscale; (void)alpha;
+    return (edgerr = "Can't make mapped EDG file - memory mapping is not supported on this platform."), nullptr;
+    #endif
+}
+
+int32_t edg_sync(edg * edge)
+{
+    if(!edge) return (edgerr = "EDG is null"), -1;
+    #if EDG_POSIX
+    if(edge->storage == EDG_STORAGE_MAPPED and msync(edge->mapping, edge->mapping_size, MS_SYNC) != 0)
+        return (edgerr = "Failed to write mapped EDG data to disk."), -2;
+    #endif
+    return 0;
+}
+
+edg * edg_wrap(const edginfo * info, unsigned char * data, uint64_t size, edg_deleter deleter, void * userdata)
+{
+    if(!info) return (edgerr = "Info is null"), nullptr;
+    if(!data) return (edgerr = "Data is null"), nullptr;
+    
+    unsigned pixelsize = pixel_length(info->grayscale, info->alpha, info->format);
+    uint64_t pixels_tall = uint64_t(info->height)+1;
+    uint64_t pixels_wide = uint64_t(info->width)+1;
+    uint64_t bytes_to_store = pixels_wide*pixels_tall*pixelsize;
     
-    xor1 ^= 'G';
-    xor2 ^= 0;
+    if(bytes_to_store/pixels_wide/pixels_tall != pixelsize)
+        return (edgerr = "Can't wrap EDG - image data contains too many byte values to address in 64-bit space."), nullptr;
+    if(size < bytes_to_store)
+        return (edgerr = "Can't wrap EDG - buffer is too small for the image."), nullptr;
     
-    xor1 ^= ((char *)(&edge->info.height))[0];
-    xor2 ^= ((char *)(&edge->info.height))[1];
+    edg * edge = edg_new<edg>();
+    if(!edge) return (edgerr = "Failed to allocate edg metadata structure."), nullptr;
     
-    xor1 ^= ((char *)(&edge->info.height))[2];
-    xor2 ^= ((char *)(&edge->info.height))[3];
+    edge->info = *info;
+    edge->size = bytes_to_store;
+    edge->data = data;
+    edge->capacity = size;
+    edge->storage = EDG_STORAGE_WRAPPED;
+    edge->deleter = deleter;
+    edge->userdata = userdata;
+    
+    return edge;
+}
+
+#if EDG_POSIX
+
+// Writes all of "iov", retrying short writes. Modifies "iov".
+bool write_all(int fd, struct iovec * iov, int count)
+{
+    while(count > 0)
+    {
+        ssize_t amount = writev(fd, iov, count);
+        if(amount < 0 and errno == EINTR) continue;
+        if(amount < 0) return false;
+        // skip what was written, which can end partway through an entry
+        while(count > 0 and size_t(amount) >= iov->iov_len)
+        {
+            amount -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + amount;
+            iov->iov_len -= amount;
+        }
+    }
+    return true;
+}
+
+#ifdef O_DIRECT
+// Writes the header and data through O_DIRECT, which needs block-aligned buffers, offsets and lengths.
+// Everything goes through an aligned bounce buffer, the last block is padded out, and the padding is cut off afterwards.
+const uint64_t direct_align = 0x1000;
+const uint64_t direct_chunk = 0x800000; // length of the bounce buffer
+
+bool write_direct(int fd, unsigned char * bounce, const unsigned char * header, const unsigned char * data, uint64_t size)
+{
+    const uint64_t align = direct_align;
+    const uint64_t chunk = direct_chunk;
     
-    xor1 ^= ((char *)(&edge->info.width))[0];
-    xor2 ^= ((char *)(&edge->info.width))[1];
+    uint64_t total = 0x10+size;
+    for(uint64_t pos = 0; pos < total; pos += chunk)
+    {
+        uint64_t amount = total-pos < chunk ? total-pos : chunk;
+        uint64_t filled = 0;
+        if(pos < 0x10)
+        {
+            filled = 0x10-pos;
+            memcpy(bounce, header+pos, filled);
+        }
+        memcpy(bounce+filled, data+(pos+filled-0x10), amount-filled);
+        
+        uint64_t padded = (amount+align-1)/align*align;
+        memset(bounce+amount, 0, padded-amount);
+        
+        struct iovec iov = {bounce, size_t(padded)};
+        if(!write_all(fd, &iov, 1)) return false;
+    }
     
-    xor1 ^= ((char *)(&edge->info.width))[2];
-    xor2 ^= ((char *)(&edge->info.width))[3];
+    return ftruncate(fd, total) == 0;
+}
+#endif
+
+// Saves native-endian data with raw syscalls: the header and data go out together in one writev.
+int32_t save_posix(const unsigned char * header, const unsigned char * data, uint64_t size, const char * fname, int flags)
+{
+    int fd = -1;
+    #ifdef O_DIRECT
+    // the bounce buffer is allocated before the file is truncated, so that an allocator without aligned_alloc just falls through to a normal save
+    unsigned char * bounce = (flags & EDG_SAVE_DIRECT) ? (unsigned char *)edg_allocate_aligned(direct_align, direct_chunk) : nullptr;
+    defer bounce_free
+    ([bounce](){
+        edg_deallocate(bounce);
+    });
+    if(bounce)
+    {
+        // not every filesystem supports O_DIRECT, in which case this just falls through to a normal save
+        fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC|O_DIRECT, 0666);
+        if(fd >= 0)
+        {
+            bool success = write_direct(fd, bounce, header, data, size);
+            if(close(fd) != 0) success = false;
+            if(!success) return (edgerr = "Failed to write image data to file. File may be truncated."), -3;
+            return 0;
+        }
+    }
+    #endif
     
-    xor1 ^= 0xFF; // barrier
-    xor2 ^= flags;
+    fd = open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if(fd < 0) return (edgerr = "Failed to open file."), -2;
     
-    file.put(xor1);
-    file.put(xor2);
+    struct iovec iov[2] = {{(void *)header, 0x10}, {(void *)data, size_t(size)}};
+    bool success = write_all(fd, iov, 2);
+    if(close(fd) != 0) success = false;
+    if(!success) return (edgerr = "Failed to write image data to file. File may be truncated."), -3;
     
-    if(!file) return (edgerr = "Failed to write header to file. File may be truncated."), -3;
+    return 0;
+}
+
+#endif // EDG_POSIX
+
+int32_t edg_save(edg * edge, const char * fname, int flags)
+{
+    if(!edge) return (edgerr = "EDG is null"), -1;
+    if(!edge->data) return (edgerr = "EDG's data is null"), -1;
+    if(!fname) return (edgerr = "Filename is null"), -1;
+    
+    #if EDG_POSIX
+    // foreign-endian floats need converting on the way out, which the stream path does a chunk at a time
+    if(edge->info.endian == HAVE_LITTLE_ENDIAN_PLATFORM or !edge->info.format)
+    {
+        unsigned char header[0x10];
+        build_header(edge->info, header);
+        return save_posix(header, edge->data, stored_bytes(edge), fname, flags);
+    }
+    #else
+    (void)flags;
+    #endif
+    
+    std::ofstream file;
+    file.open(fname, file.out|file.binary);
+    if(!file) return (edgerr = "Failed to open file."), -2;
+    
+    return edg_save_stream(edge, file);
+}
+
+int32_t edg_save_stream(edg * edge, std::ostream & stream)
+{
+    if(!edge) return (edgerr = "EDG is null"), -1;
+    if(!edge->data) return (edgerr = "EDG's data is null"), -1;
+    
+    // write header
+    
+    unsigned char header[0x10];
+    build_header(edge->info, header);
+    stream.write((const char *)header, 0x10);
+    
+    if(!stream) return (edgerr = "Failed to write header to file. File may be truncated."), -3;
     
     // write image data to file
     
-    file.write((char *)edge->data, edge->size);
+    if(!write_values(stream, edge->data, stored_bytes(edge), edge->info))
+        return (edgerr = "Failed to write image data to file. File may be truncated."), -3;
+    
+    stream.flush();
+    if(!stream) return (edgerr = "Failed to flush image data to file. File may be truncated."), -3;
+    
+    return 0;
+}
+
+uint64_t edg_encoded_size(const edg * edge)
+{
+    return 0x10 + stored_bytes(edge);
+}
+
+int64_t edg_encode_mem(const edg * edge, unsigned char * out, uint64_t capacity)
+{
+    if(!edge) return (edgerr = "EDG is null"), -1;
+    if(!edge->data) return (edgerr = "EDG's data is null"), -1;
+    if(!out) return (edgerr = "Output buffer is null"), -1;
+    
+    uint64_t bytes = stored_bytes(edge);
+    if(capacity < 0x10+bytes) return (edgerr = "Output buffer is too small; see edg_encoded_size."), -2;
+    
+    build_header(edge->info, out);
+    if(edge->info.endian != HAVE_LITTLE_ENDIAN_PLATFORM and edge->info.format)
+        edg_byteswap32(out+0x10, edge->data, bytes/4);
+    else
+        memcpy(out+0x10, edge->data, bytes);
+    
+    return 0x10+bytes;
+}
+
+struct edg_writer
+{
+    std::ofstream file;
+    edginfo info; // endian is the file's endian
+    uint64_t row_size;
+    uint64_t next_row; // index of the next scanline to be written
+};
+
+edg_writer * edg_writer_open(const char * fname, const edginfo * info)
+{
+    if(!fname) return (edgerr = "Filename is null"), nullptr;
+    if(!info) return (edgerr = "Info is null"), nullptr;
+    
+    edg_writer * writer = edg_new<edg_writer>();
+    if(!writer) return (edgerr = "Failed to allocate edg writer."), nullptr;
+    
+    defer writer_free
+    ([writer](){
+        edg_delete(writer);
+    });
+    
+    writer->info = *info;
+    writer->row_size = (uint64_t(info->width)+1)*pixel_length(info->grayscale, info->alpha, info->format);
+    writer->next_row = 0;
+    
+    if(uint64_t(size_t(writer->row_size)) != writer->row_size)
+        return (edgerr = "Can't stream EDG file - scanline too large to fit into size_t."), nullptr;
+    
+    writer->file.open(fname, std::ios::binary|std::ios::out);
+    if(!writer->file) return (edgerr = "Failed to open file."), nullptr;
+    
+    unsigned char header[0x10];
+    build_header(writer->info, header);
+    writer->file.write((const char *)header, 0x10);
+    if(!writer->file) return (edgerr = "Failed to write header to file."), nullptr;
+    
+    writer_free.deferred = [](){};
+    
+    return writer;
+}
+
+uint64_t edg_writer_row_size(edg_writer * writer)
+{
+    return writer->row_size;
+}
+
+int32_t edg_writer_write(edg_writer * writer, const unsigned char * buffer, uint64_t rows)
+{
+    if(!writer) return (edgerr = "Writer is null"), -1;
+    if(!buffer) return (edgerr = "Buffer is null"), -1;
     
-    if(!file) return (edgerr = "Failed to write image data to file. File may be truncated."), -3;
+    uint64_t rows_left = uint64_t(writer->info.height)+1-writer->next_row;
+    if(rows > rows_left) return (edgerr = "Tried to write more scanlines than the image has."), -1;
+    if(rows > SIZE_MAX/writer->row_size) return (edgerr = "Too many scanlines written at once."), -1;
     
-    file.flush();
+    if(!write_values(writer->file, buffer, rows*writer->row_size, writer->info))
+        return (edgerr = "Failed to write image data to file. File may be truncated."), -3;
+    
+    writer->next_row += rows;
+    
+    return 0;
+}
+
+int32_t edg_writer_close(edg_writer * writer)
+{
+    if(!writer) return (edgerr = "Writer is null"), -1;
+    
+    writer->file.flush();
+    bool failed = !writer->file;
+    edg_delete(writer);
+    
+    if(failed) return (edgerr = "Failed to flush image data to file. File may be truncated."), -3;
     
     return 0;
 }
@@ -453,8 +1785,147 @@ int32_t edg_kill(edg * edge)
 {
     if(!edge) return (edgerr = "EDG is null"), -1;
     if(!edge->data) return (edgerr = "EDG's data is null"), -1;
-    free(edge->data);
-    free(edge);
+    int32_t rcode = release_data(edge);
+    if(rcode < 0) return rcode;
+    edg_deallocate(edge->white_row);
+    edg_delete(edge);
+    
+    return 0;
+}
+
+int32_t edg_release_data(edg * edge)
+{
+    if(!edge) return (edgerr = "EDG is null"), -1;
+    if(edge->data)
+    {
+        int32_t rcode = release_data(edge);
+        if(rcode < 0) return rcode;
+    }
+    edg_deallocate(edge->white_row);
+    *edge = edg{};
     
     return 0;
 }
+
+struct edg_loader
+{
+    struct loaded
+    {
+        edg * edge;
+        uint64_t index;
+        const char * error;
+    };
+    
+    std::vector<std::string> fnames;
+    uint32_t flags;
+    uint64_t max_in_flight;
+    
+    std::mutex mutex;
+    std::condition_variable space; // signalled when an image is taken
+    std::condition_variable ready; // signalled when an image finishes loading
+    std::deque<loaded> done;
+    uint64_t next_index = 0; // next file to start loading
+    uint64_t in_flight = 0; // started, but not yet taken
+    uint64_t taken = 0;
+    bool stopping = false;
+    
+    std::vector<std::thread> workers;
+};
+
+void loader_work(edg_loader * loader)
+{
+    while(true)
+    {
+        uint64_t index;
+        {
+            std::unique_lock<std::mutex> lock(loader->mutex);
+            loader->space.wait(lock, [loader](){
+                return loader->stopping or loader->next_index >= loader->fnames.size() or loader->in_flight < loader->max_in_flight;
+            });
+            if(loader->stopping or loader->next_index >= loader->fnames.size()) return;
+            index = loader->next_index++;
+            loader->in_flight++;
+        }
+        
+        edg * edge = edg_open(loader->fnames[index].c_str(), loader->flags);
+        const char * error = edge ? "" : edgerr;
+        
+        {
+            std::lock_guard<std::mutex> lock(loader->mutex);
+            loader->done.push_back({edge, index, error});
+        }
+        loader->ready.notify_one();
+    }
+}
+
+edg_loader * edg_loader_start(const char * const * fnames, uint64_t count, unsigned max_in_flight, unsigned threads, uint32_t flags)
+{
+    if(!fnames and count > 0) return (edgerr = "Filename list is null"), nullptr;
+    if(max_in_flight == 0) return (edgerr = "At least one image must be allowed in flight."), nullptr;
+    for(uint64_t i = 0; i < count; i++)
+        if(!fnames[i]) return (edgerr = "Filename is null"), nullptr;
+    
+    edg_loader * loader = edg_new<edg_loader>();
+    if(!loader) return (edgerr = "Failed to allocate edg loader."), nullptr;
+    
+    loader->fnames.assign(fnames, fnames+count);
+    loader->flags = flags;
+    loader->max_in_flight = max_in_flight;
+    
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    if(threads == 0) threads = 4;
+    if(threads > max_in_flight) threads = max_in_flight;
+    if(threads > count) threads = count;
+    
+    for(unsigned i = 0; i < threads; i++)
+        loader->workers.emplace_back(loader_work, loader);
+    
+    return loader;
+}
+
+int32_t edg_loader_next(edg_loader * loader, edg ** edge, uint64_t * index, const char ** error)
+{
+    if(!loader) return (edgerr = "Loader is null"), -1;
+    if(!edge) return (edgerr = "EDG output is null"), -1;
+    
+    edg_loader::loaded item;
+    {
+        std::unique_lock<std::mutex> lock(loader->mutex);
+        if(loader->taken >= loader->fnames.size()) return 0;
+        loader->ready.wait(lock, [loader](){ return !loader->done.empty(); });
+        item = loader->done.front();
+        loader->done.pop_front();
+        loader->in_flight--;
+        loader->taken++;
+    }
+    loader->space.notify_one();
+    
+    *edge = item.edge;
+    if(index) *index = item.index;
+    if(error) *error = item.error;
+    
+    return 1;
+}
+
+int32_t edg_loader_finish(edg_loader * loader)
+{
+    if(!loader) return (edgerr = "Loader is null"), -1;
+    
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->stopping = true;
+    }
+    loader->space.notify_all();
+    for(auto & worker : loader->workers)
+        worker.join();
+    
+    for(auto & item : loader->done)
+        if(item.edge) edg_kill(item.edge);
+    
+    edg_delete(loader);
+    return 0;
+}
+
+#include "libedg_uring.cpp"
+#include "libedg_convert.cpp"
+#include "libedg_crop.cpp"
@@ -32,6 +32,7 @@
 */
 
 #include <stdint.h>
+#include <iosfwd> // std::istream, std::ostream
 
 /* IMPORTANT!
 // height/width START AT 0. An image of one pixel has a height and with of zero! A square with four pixels has a height and width of one!
@@ -43,7 +44,8 @@
 // alpha: if true, pixels have an additional "alpha" value.
 // tile___: if true, indicates that the image specifically specifies that a given edge should be center-aligned / match edges (yes, those are the same thing). if false, indicates undefined alignment/matching, not opposite matching.
 
-extern const char * edgerr;
+// Message describing the last error on the calling thread. Each thread has its own, so libedg can be called from several threads at once.
+extern thread_local const char * edgerr;
 
 struct edginfo
 {
@@ -60,27 +62,328 @@ struct edginfo
     bool tileright;
 };
 
+// Memory allocation hooks. userdata is passed through to every call.
+// alloc must return memory aligned for any type, like malloc, or nullptr on failure.
+// aligned_alloc returns memory aligned to "alignment", a power of two, or nullptr on failure. It's only needed for EDG_SAVE_DIRECT, and may be nullptr.
+// free must release memory from both alloc and aligned_alloc, and ignore nullptr.
+struct edg_allocator
+{
+    void * (*alloc)(uint64_t size, void * userdata);
+    void (*free)(void * memory, void * userdata);
+    void * (*aligned_alloc)(uint64_t alignment, uint64_t size, void * userdata);
+    void * userdata;
+};
+
+// Routes libedg's allocations through "allocator": edgs and their buffers, readers, writers, loaders, and large scratch buffers. nullptr restores malloc and free.
+// Memory is freed through whichever allocator is set at the time, so set it before allocating anything, and don't change it while anything is alive. Empties the buffer pool.
+// Not thread-safe: nothing else may be calling into libedg while it's changed.
+// Returns an error code and sets edgerr on error.
+int32_t edg_set_allocator(const edg_allocator * allocator);
+
+// Counters for the pixel buffer pool.
+struct edg_pool_stats
+{
+    uint64_t limit; // most bytes the pool will hold; 0 means pooling is off
+    uint64_t cached_bytes; // bytes of buffers sitting in the pool
+    uint64_t cached_buffers;
+    uint64_t hits; // allocations served from the pool
+    uint64_t misses; // allocations that had to go to the allocator while pooling was on
+    uint64_t returned; // buffers kept by the pool when released
+    uint64_t dropped; // buffers freed on release because the pool was full
+};
+
+// While pooling is on, pixel buffers are allocated in size classes (a quarter of a power of two apart, from 64 KiB up), so that images of similar sizes can share buffers. With it off, they are allocated at their exact size.
+// With a nonzero limit, edg_kill keeps released buffers in a pool, up to "bytes" bytes in total, and edg_open, edg_make and the other loaders take buffers from it.
+// Pooling is off by default. Lowering the limit frees cached buffers until the pool fits. Thread-safe.
+void edg_pool_set_limit(uint64_t bytes);
+// Frees every buffer cached in the pool, leaving the limit alone.
+void edg_pool_trim();
+edg_pool_stats edg_pool_get_stats();
+
+// How an edg's buffer is owned, and so how edg_kill releases it.
+enum
+{
+    EDG_STORAGE_MALLOC = 0, // data was allocated through the allocator; see edg_set_allocator
+    EDG_STORAGE_MAPPED = 1, // data points into a file mapping; see edg_open_mapped and edg_create_mapped
+    EDG_STORAGE_WRAPPED = 2 // data belongs to the caller, and is handed to a deleter, if any; see edg_wrap
+};
+
+// Releases a buffer adopted by edg_wrap. userdata is whatever was given to edg_wrap.
+typedef void (*edg_deleter)(unsigned char * data, void * userdata);
+
 // data format: top-left origin, next pixel is rightwards before downwarrds, values packed per pixel in RGBA order, one at a time
 struct edg
 {
     edginfo info;
     uint64_t size;
     unsigned char * data;
+    // Number of bytes allocated for data, which can be more than size; see edg_open_into and edg_pool_set_limit
+    // 0 if data is borrowed read-only (see EDG_DECODE_VIEW), in which case nothing writes to it
+    uint64_t capacity = 0;
+    
+    int storage = EDG_STORAGE_MALLOC;
+    // Start and length of the mapping that data points into, if mapped.
+    void * mapping = nullptr;
+    uint64_t mapping_size = 0;
+    // How to release data, if wrapped.
+    edg_deleter deleter = nullptr;
+    void * userdata = nullptr;
+    
+    // Number of scanlines at the bottom of the image that are white because the file was truncated, but were never written to data.
+    // Always 0 unless loaded with EDG_OPEN_VIRTUAL_WHITE. Read those scanlines with edg_row, or fill them in with edg_materialize.
+    uint64_t white_rows = 0;
+    // One scanline of white, which edg_row hands out for the scanlines counted by white_rows.
+    unsigned char * white_row = nullptr;
+};
+
+// Flags for edg_open and edg_open_into.
+enum
+{
+    // If the file is truncated, don't fill in the missing scanlines with white. Just count them in white_rows, for edg_row to serve.
+    // Saves writing out white for heavily truncated files, such as partially written captures, and leaves that part of the buffer untouched.
+    EDG_OPEN_VIRTUAL_WHITE = 1,
+    // Read large images in chunks on one thread per core, each thread byteswapping its chunks as they arrive.
+    // Helps on storage that one sequential read can't saturate, such as NVMe. The threads are started for each call, and share one open descriptor for the file.
+    // Ignored for small images, and on platforms without pread.
+    EDG_OPEN_PARALLEL = 2,
+    // edg_decode_mem only: if the data can be used as is (native endian, not truncated, and aligned for its values), point into the span instead of copying it.
+    EDG_DECODE_VIEW = 4
 };
 
 // Loads an EDG file from disk, then closes the file, without modifying it. Allocates a buffer and an info struct.
 // Returns nullptr and sets edgerr on failure.
 // Note: Does NOT return an edg with the same endian as the file. ONLY loads edg files into native endian. Sets edginfo's endian field to native endian.
-edg * edg_open(const char * filename);
-// Makes an EDG in RAM. Allocates a buffer and an info struct.
+edg * edg_open(const char * filename, uint32_t flags = 0);
+// Loads an EDG file from a stream, such as std::cin. Never seeks, so pipes and sockets work.
+// Reads exactly as much image data as the header implies. If the stream ends early, the image is truncated, and filled in with white as with edg_open.
+// If it doesn't, the stream is read to its end and the rest is thrown away as padding.
+// Returns nullptr and sets edgerr on failure.
+edg * edg_open_stream(std::istream & stream);
+// Loads an EDG file from disk into an existing edg, like edg_open, replacing its contents.
+// The edg's buffer is reused if its capacity is large enough for the image, so loading same-sized images in a loop allocates nothing after the first.
+// Otherwise, a new buffer is allocated and the old one is released. edge may also be an empty edg (edg edge = {}), in which case a buffer is always allocated.
+// Release an edg that libedg didn't allocate with edg_release_data, not edg_kill.
+// Returns an error code and sets edgerr on error. On error, edge remains valid, but the contents of its buffer are unspecified.
+int32_t edg_open_into(edg * edge, const char * filename, uint32_t flags = 0);
+// Decodes an EDG from a span of memory holding the whole file, like edg_open. Does not modify the span.
+// With EDG_DECODE_VIEW, the edg may borrow the span instead of copying it. Such an edg must not be written to, and the span must outlive it.
+// Its capacity is 0, so edg_open_into allocates a new buffer for it instead of loading into the span.
+// Returns nullptr and sets edgerr on failure.
+edg * edg_decode_mem(const unsigned char * bytes, uint64_t length, uint32_t flags = 0);
+// Gets a pointer to scanline y, including scanlines that are only virtually white (see EDG_OPEN_VIRTUAL_WHITE). y must be inside the image.
+const unsigned char * edg_row(const edg * edge, uint64_t y);
+// Fills in any virtually white scanlines, so that all of data is valid.
+// Returns an error code and sets edgerr on error.
+int32_t edg_materialize(edg * edge);
+// Like edg_open, but maps the file into memory instead of copying it, so data points directly at the image data in the page cache.
+// The mapping is private: writing to data does not modify the file.
+// Only native-endian, non-truncated files can be mapped. Other files, and platforms without mmap, silently fall back to edg_open.
+// Returns nullptr and sets edgerr on failure. Release with edg_kill, like any other edg.
+edg * edg_open_mapped(const char * filename);
+// Loads only a rectangle of an EDG file from disk, reading just the scanline segments inside it.
+// The region's top left pixel is at y, x. Like edg_make, height and width MEASURE PIXEL SPANS (counting starts at 0).
+// Truncated files are filled in with white, and the result is in native endian, as with edg_open. The region keeps the tile flags of the image edges it touches.
+// Returns nullptr and sets edgerr on failure, including if the region doesn't fit inside the image.
+edg * edg_open_region(const char * filename, uint32_t y, uint32_t x, uint32_t height, uint32_t width);
+// What edg_make fills a new image with.
+enum
+{
+    EDG_FILL_WHITE = 0,        // every value is 255 or 1.0f
+    EDG_FILL_ZERO = 1,         // every value is 0; pages are zeroed lazily by the OS where possible
+    EDG_FILL_UNINITIALIZED = 2 // contents are garbage; for callers that are about to overwrite every pixel anyway
+};
+
+// Makes an EDG in RAM. Allocates a buffer and an info struct, and fills the buffer according to "fill".
 // Returns nullptr and sets edgerr on failure.
 // NOTE: HEIGHT AND WIDTH MEASURE PIXEL SPANS, NOT PIXEL CENTERS (counting starts at 0, not 1, for non-empty images)
-edg * edg_make(uint32_t height, uint32_t width, bool format, bool grayscale, bool alpha);
+edg * edg_make(uint32_t height, uint32_t width, bool format, bool grayscale, bool alpha, int fill = EDG_FILL_WHITE);
+// Creates an EDG file on disk with the given shape, writes its header, and maps its image data into memory, so that pixels written to data go straight to the file.
+// Takes the same arguments as edg_make. Every fill policy but EDG_FILL_WHITE leaves the data zeroed, since new files read as zeroes.
+// The header is fixed when the file is created. Changing info afterwards does not change the file.
+// Returns nullptr and sets edgerr on failure, including on platforms without mmap.
+// edg_kill unmaps the data; the OS writes it back to the file whenever it likes. Use edg_sync to wait for it.
+edg * edg_create_mapped(const char * filename, uint32_t height, uint32_t width, bool format, bool grayscale, bool alpha, int fill = EDG_FILL_ZERO);
+// Waits for the data of an edg made by edg_create_mapped to be written to disk. Does nothing for other edgs.
+// Returns an error code and sets edgerr on error.
+int32_t edg_sync(edg * edge);
+// Makes an EDG around an existing buffer, without copying or filling it. Allocates only the info struct.
+// data must be in native endian, and at least as long as the image described by info; size is its full length in bytes.
+// When the edg is killed, deleter is called with data and userdata. If deleter is nullptr, the buffer is only borrowed, and is left alone.
+// Returns nullptr and sets edgerr on failure, in which case the buffer is NOT handed to the deleter.
+edg * edg_wrap(const edginfo * info, unsigned char * data, uint64_t size, edg_deleter deleter, void * userdata = nullptr);
+// Flags for edg_save.
+enum
+{
+    // Bypass the page cache where the platform supports it (O_DIRECT). Only worth it for large images that won't be read back soon.
+    // Silently ignored where unsupported.
+    EDG_SAVE_DIRECT = 1
+};
+
 // Saves an EDG from ram to disk. Does not modify the EDG in ram.
+// Virtually white scanlines are not written, so the file is truncated where the one it was loaded from was.
+// The data must be in native endian. If info.endian is set to the other endian, the file is written in that endian, converting as it goes.
+// On POSIX platforms, native-endian images are written with a single writev of the header and data.
+// Returns an error code and sets edgerr on error.
+int32_t edg_save(edg * edge, const char * filename, int flags = 0);
+
+// Status bits returned by edg_probe.
+enum
+{
+    EDG_PROBE_TRUNCATED = 1, // the file is shorter than its header implies, so edg_open will fill in white
+    EDG_PROBE_PADDED = 2     // the file is longer than its header implies, so edg_open will ignore the end
+};
+
+// Reads just the header of an EDG file, without touching any image data, and gets the length of the file.
+// Info is stored as it is in the file, including its endian. file_length may be nullptr.
+// Returns a combination of EDG_PROBE_ bits, 0 meaning the file is exactly as long as its header implies.
+// Returns a negative error code and sets edgerr on failure.
+int32_t edg_probe(const char * filename, edginfo * info, uint64_t * file_length);
+
+struct edg_probe_result
+{
+    int32_t status; // what edg_probe returned for this file
+    const char * error; // what edg_probe set edgerr to for this file, if status is negative
+    edginfo info;
+    uint64_t file_length;
+};
+
+// Probes "count" files at once, on "threads" threads (0 picks a default suited to syscall-bound work). Does not set edgerr.
+// results must point to "count" results, which are stored in the same order as filenames.
+void edg_probe_batch(const char * const * filenames, uint64_t count, edg_probe_result * results, unsigned threads);
+
+// Reads an EDG file a few scanlines at a time, for images too large to load whole.
+struct edg_reader;
+
+// Opens an EDG file for streaming and reads its header. Does not read any image data.
+// Returns nullptr and sets edgerr on failure.
+edg_reader * edg_reader_open(const char * filename);
+// Like edg_reader_open, but reads from a stream, such as std::cin, which must outlive the reader. Never seeks, so pipes and sockets work.
+// Truncation is detected by the stream ending early. Nothing past the image data is read, so any padding is left in the stream.
+edg_reader * edg_reader_open_stream(std::istream & stream);
+// Gets the info of the image being read. Like edg_open, endian is always native endian, since scanlines are converted as they're read.
+edginfo edg_reader_info(edg_reader * reader);
+// Byte length of a single scanline.
+uint64_t edg_reader_row_size(edg_reader * reader);
+// Reads the next "rows" scanlines into buffer, which must be at least rows*edg_reader_row_size bytes long, in native endian.
+// If the file is truncated, the missing part of the image is filled in with white, as with edg_open.
+// Returns the number of scanlines read, which is less than "rows" only at the bottom of the image, and 0 after the last scanline.
+// Returns a negative error code and sets edgerr on failure.
+int64_t edg_reader_read(edg_reader * reader, unsigned char * buffer, uint64_t rows);
+// Closes the file and deallocates the reader.
 // Returns an error code and sets edgerr on error.
-int32_t edg_save(edg * edge, const char * filename);
-// Kills an EDG that exists in RAM. Deallocates the buffer, and the info struct.
+int32_t edg_reader_close(edg_reader * reader);
+
+// Saves an EDG to a stream, such as std::cout, exactly as edg_save would write it to a file.
+// Returns an error code and sets edgerr on error.
+int32_t edg_save_stream(edg * edge, std::ostream & stream);
+// Number of bytes edg_encode_mem writes for an edg, i.e. the length of the file edg_save would write.
+uint64_t edg_encoded_size(const edg * edge);
+// Encodes an EDG into a span of memory exactly as edg_save would write it to a file, converting endian if info.endian asks for it.
+// Returns the number of bytes written, or a negative error code and sets edgerr on failure, including if capacity is too small.
+int64_t edg_encode_mem(const edg * edge, unsigned char * out, uint64_t capacity);
+
+// Writes an EDG file a few scanlines at a time, without the whole image ever being in RAM.
+struct edg_writer;
+
+// Creates an EDG file for streaming and writes its header.
+// The file is written in info's endian. Scanlines are always given in native endian, and converted as they're written.
+// Returns nullptr and sets edgerr on failure.
+edg_writer * edg_writer_open(const char * filename, const edginfo * info);
+// Byte length of a single scanline.
+uint64_t edg_writer_row_size(edg_writer * writer);
+// Writes the next "rows" scanlines from buffer, which must be rows*edg_writer_row_size bytes long. Does not modify buffer.
+// Returns an error code and sets edgerr on error, including if more scanlines are written than the image has.
+int32_t edg_writer_write(edg_writer * writer, const unsigned char * buffer, uint64_t rows);
+// Flushes and closes the file, and deallocates the writer.
+// If fewer scanlines were written than the image has, the file is left truncated, which decoders fill in with white.
+// Returns an error code and sets edgerr on error.
+int32_t edg_writer_close(edg_writer * writer);
+
+// Reverses the byte order of "count" 32-bit values from src into dst, using the fastest kernel the CPU supports.
+// dst and src may be the same buffer for an in-place swap, but must not otherwise overlap.
+void edg_byteswap32(unsigned char * dst, const unsigned char * src, uint64_t count);
+
+// The 256-entry table of 8-bit sRGB values converted to linear floats, as srgb2linear(i/255.0f) would.
+const float * edg_srgb8_table();
+// Converts "count" 8-bit sRGB values to linear floats, through the table.
+void edg_srgb8_to_linear(float * dst, const unsigned char * src, uint64_t count);
+// Converts "count" linear floats to 8-bit sRGB values, giving exactly what roundf(255*clamp(linear2srgb(x), 0, 1)) would, but without calling powf.
+// Values outside 0 to 1 are clamped, and NaN becomes 0. Uses AVX2 if the CPU supports it.
+void edg_linear_to_srgb8(unsigned char * dst, const float * src, uint64_t count);
+
+// Converts an image to another of the eight pixel layouts, returning a new edg. src is left alone.
+// u8 color values are treated as sRGB and float ones as linear; alpha is linear in both. Converting to grayscale takes Rec. 709 luma in linear light.
+// Added alpha is opaque. Virtual white scanlines are converted like any other.
+// Returns nullptr and sets edgerr on failure.
+edg * edg_convert(const edg * src, bool format, bool grayscale, bool alpha);
+
+// Loads an EDG file straight into the given pixel layout, as if by edg_open and then edg_convert, but in one pass:
+// scanlines are read a chunk at a time and converted into the new image while they're still in cache, and the file's own layout is never held in full.
+// Returns nullptr and sets edgerr on failure.
+edg * edg_open_as(const char * filename, bool format, bool grayscale, bool alpha);
+// Like edg_open_as, but reads from a stream, such as std::cin. Never seeks.
+edg * edg_open_stream_as(std::istream & stream, bool format, bool grayscale, bool alpha);
+
+// A rectangle of an image that points into the image's buffer instead of copying it. Its scanlines are "stride" bytes apart, not packed.
+// Valid for as long as the image's buffer is: killing the image, or loading into it with edg_open_into, leaves the crop dangling.
+// Writing through data writes to the image.
+struct edg_crop
+{
+    edginfo info; // the rectangle's dimensions (counting from 0) and flags; always native endian data, like an edg
+    unsigned char * data; // top left pixel
+    uint64_t stride; // bytes from the start of one scanline to the start of the next
+};
+
+// Makes a crop of the rectangle at y, x. Like edg_make, height and width MEASURE PIXEL SPANS (counting starts at 0).
+// The crop keeps the tile flags of the image edges it touches, like edg_open_region. Nothing is allocated or copied.
+// Returns an error code and sets edgerr on error, including if the rectangle doesn't fit, or reaches virtual white scanlines.
+int32_t edg_crop_make(edg * edge, uint32_t y, uint32_t x, uint32_t height, uint32_t width, edg_crop * crop);
+// Makes a crop of a rectangle inside another crop, with y and x relative to the parent's top left pixel.
+// Returns an error code and sets edgerr on error.
+int32_t edg_crop_sub(const edg_crop * parent, uint32_t y, uint32_t x, uint32_t height, uint32_t width, edg_crop * crop);
+// Returns a pointer to scanline y of a crop.
+const unsigned char * edg_crop_row(const edg_crop * crop, uint64_t y);
+// Copies a crop out into a new, packed edg in the given pixel layout, converting as edg_convert does.
+// Returns nullptr and sets edgerr on failure.
+edg * edg_crop_copy(const edg_crop * crop, bool format, bool grayscale, bool alpha);
+// Saves a crop as an EDG file, a scanline at a time, without copying it out first. The file is written in the crop's info's endian.
+// Returns an error code and sets edgerr on error.
+int32_t edg_crop_save(const edg_crop * crop, const char * filename);
+
+// Kills an EDG that exists in RAM. Deallocates (or unmaps) the buffer, and the info struct.
 // Returns an error code and sets edgerr on error.
 int32_t edg_kill(edg * edge);
+// Releases an edg's buffer as edg_kill would, but leaves the edg struct itself alone and resets it to empty (as edg edge = {}).
+// For edgs that libedg didn't allocate, such as ones on the stack given to edg_open_into. Does nothing if data is null.
+// Returns an error code and sets edgerr on error, in which case the edg is left as it was.
+int32_t edg_release_data(edg * edge);
+
+// Loads a list of EDG files on background threads, so that loading the next file overlaps with processing the current one.
+struct edg_loader;
+
+// Starts loading "count" files with edg_open and "flags", on "threads" threads (0 means one per core).
+// At most max_in_flight images are loading or loaded-but-not-taken at once, which bounds memory use.
+// The filenames are copied, so the list doesn't need to outlive the loader.
+// Returns nullptr and sets edgerr on failure.
+edg_loader * edg_loader_start(const char * const * filenames, uint64_t count, unsigned max_in_flight, unsigned threads = 0, uint32_t flags = 0);
+// Waits for the next image to finish loading, in whatever order they finish, and takes it. The caller owns it, and must kill it.
+// Stores the image in *edge, or nullptr if it failed to load, in which case *error is set to what edg_open set edgerr to.
+// index receives the position of its filename in the list. index and error may be nullptr.
+// Returns 1 if an image (or failure) was taken, 0 once every file has been taken, and a negative error code and sets edgerr on failure.
+int32_t edg_loader_next(edg_loader * loader, edg ** edge, uint64_t * index, const char ** error);
+// Stops loading, waits for the background threads, kills any loaded images that weren't taken, and deallocates the loader.
+// Returns an error code and sets edgerr on error.
+int32_t edg_loader_finish(edg_loader * loader);
+
+// Loads "count" files at once, as if by edg_open with "flags", storing each image (or nullptr on failure) in edges.
+// On Linux, built with EDG_USE_IO_URING and linked with liburing, the file I/O for many files is submitted to the kernel in batches through io_uring.
+// Otherwise, or if the kernel's io_uring can't open, stat, read, write and close files (Linux 5.6 and up), the files are loaded one at a time.
+// errors receives what edg_open would have set edgerr to for each file, or "" on success. errors may be nullptr.
+// Returns the number of files that failed to load, or a negative error code and sets edgerr on misuse.
+int64_t edg_open_batch(const char * const * filenames, uint64_t count, edg ** edges, const char ** errors, uint32_t flags = 0);
+// Saves "count" edgs at once, as if by edg_save, with the same io_uring batching as edg_open_batch.
+// errors receives what edg_save would have set edgerr to for each file, or "" on success. errors may be nullptr.
+// Returns the number of files that failed to save, or a negative error code and sets edgerr on misuse.
+int64_t edg_save_batch(edg * const * edges, const char * const * filenames, uint64_t count, const char ** errors);
 
 #endif // EDGUP_LIB
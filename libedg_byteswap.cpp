@@ -0,0 +1,137 @@
+/*
+   Copyright 2016 Alexander Nadeau <wareya@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "LICENSE");
+   you may not use this file except in compliance with the LICENSE.
+   You may obtain a copy of the LICENSE at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the LICENSE is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the LICENSE for the specific language governing permissions and
+   limitations under the LICENSE.
+*/
+
+// Endian conversion of 32-bit values, for loading and saving float EDGs in the other endian.
+// Included by libedg.cpp; not meant to be compiled on its own.
+//
+// x86 gets SSE2, SSSE3, AVX2 and AVX-512 kernels, picked once at runtime from CPUID.
+// Everything else, and compilers without per-function target attributes, get the scalar kernel.
+
+#include <stdint.h>
+#include <string.h> // memcpy
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define EDG_BYTESWAP_X86 1
+#include <immintrin.h>
+#else
+#define EDG_BYTESWAP_X86 0
+#endif
+
+void byteswap32_scalar(unsigned char * dst, const unsigned char * src, uint64_t count)
+{
+    for(uint64_t i = 0; i < count; i++)
+    {
+        uint32_t value;
+        memcpy(&value, src+i*4, 4);
+        value = (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24);
+        memcpy(dst+i*4, &value, 4);
+    }
+}
+
+#if EDG_BYTESWAP_X86
+
+// SSE2 has no byte shuffle: swap the bytes of each 16-bit half with shifts, then swap the halves.
+__attribute__((target("sse2")))
+void byteswap32_sse2(unsigned char * dst, const unsigned char * src, uint64_t count)
+{
+    uint64_t i = 0;
+    for(; i+4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src+i*4));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i *)(dst+i*4), v);
+    }
+    byteswap32_scalar(dst+i*4, src+i*4, count-i);
+}
+
+__attribute__((target("ssse3")))
+void byteswap32_ssse3(unsigned char * dst, const unsigned char * src, uint64_t count)
+{
+    const __m128i order = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    uint64_t i = 0;
+    for(; i+4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src+i*4));
+        _mm_storeu_si128((__m128i *)(dst+i*4), _mm_shuffle_epi8(v, order));
+    }
+    byteswap32_scalar(dst+i*4, src+i*4, count-i);
+}
+
+__attribute__((target("avx2")))
+void byteswap32_avx2(unsigned char * dst, const unsigned char * src, uint64_t count)
+{
+    // vpshufb shuffles within each 128-bit lane, so the pattern is repeated per lane
+    const __m256i order = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    uint64_t i = 0;
+    for(; i+16 <= count; i += 16)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src+i*4));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src+i*4+32));
+        _mm256_storeu_si256((__m256i *)(dst+i*4), _mm256_shuffle_epi8(a, order));
+        _mm256_storeu_si256((__m256i *)(dst+i*4+32), _mm256_shuffle_epi8(b, order));
+    }
+    for(; i+8 <= count; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src+i*4));
+        _mm256_storeu_si256((__m256i *)(dst+i*4), _mm256_shuffle_epi8(a, order));
+    }
+    byteswap32_scalar(dst+i*4, src+i*4, count-i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void byteswap32_avx512(unsigned char * dst, const unsigned char * src, uint64_t count)
+{
+    // vpshufb shuffles within each 128-bit lane, so the pattern is the same for every four values
+    const __m512i order = _mm512_set4_epi32(0x0C0D0E0F, 0x08090A0B, 0x04050607, 0x00010203);
+    uint64_t i = 0;
+    for(; i+16 <= count; i += 16)
+    {
+        __m512i a = _mm512_loadu_si512((const void *)(src+i*4));
+        _mm512_storeu_si512((void *)(dst+i*4), _mm512_shuffle_epi8(a, order));
+    }
+    // masked load/store for the tail instead of falling back to scalar
+    if(i < count)
+    {
+        __mmask16 mask = (__mmask16)((1u << (count-i)) - 1);
+        __m512i a = _mm512_maskz_loadu_epi32(mask, (const void *)(src+i*4));
+        _mm512_mask_storeu_epi32((void *)(dst+i*4), mask, _mm512_shuffle_epi8(a, order));
+    }
+}
+
+#endif // EDG_BYTESWAP_X86
+
+typedef void (*byteswap32_kernel)(unsigned char * dst, const unsigned char * src, uint64_t count);
+
+byteswap32_kernel pick_byteswap32()
+{
+    #if EDG_BYTESWAP_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512bw")) return byteswap32_avx512;
+    if(__builtin_cpu_supports("avx2"))     return byteswap32_avx2;
+    if(__builtin_cpu_supports("ssse3"))    return byteswap32_ssse3;
+    if(__builtin_cpu_supports("sse2"))     return byteswap32_sse2;
+    #endif
+    return byteswap32_scalar;
+}
+
+void edg_byteswap32(unsigned char * dst, const unsigned char * src, uint64_t count)
+{
+    static const byteswap32_kernel kernel = pick_byteswap32();
+    kernel(dst, src, count);
+}
@@ -0,0 +1,262 @@
+/*
+   Copyright 2016 Alexander Nadeau <wareya@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "LICENSE");
+   you may not use this file except in compliance with the LICENSE.
+   You may obtain a copy of the LICENSE at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the LICENSE is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the LICENSE for the specific language governing permissions and
+   limitations under the LICENSE.
+*/
+
+// Conversion between the eight pixel layouts an EDG can have.
+// Included by libedg.cpp; not meant to be compiled on its own.
+//
+// u8 color values are sRGB encoded and float ones are linear, so changing format goes through the sRGB tables.
+// Alpha is linear in both, and is only ever scaled. Grayscale is Rec. 709 luma, taken in linear light.
+// There's a row kernel for every source/destination pair, with the channel counts known at compile time so that the
+// compiler can unroll and vectorize the per-pixel work. They're picked from a table indexed by both layouts.
+
+#include <utility> // std::index_sequence
+
+// Layouts are numbered format*4 + grayscale*2 + alpha.
+inline unsigned layout_index(bool format, bool grayscale, bool alpha)
+{
+    return (format?4:0) | (grayscale?2:0) | (alpha?1:0);
+}
+
+// scaled, not sRGB decoded
+struct unorm8_table
+{
+    float values[256];
+    unorm8_table() { for(int i = 0; i < 256; i++) values[i] = i/255.0f; }
+};
+
+const unorm8_table & get_unorm8_table()
+{
+    static const unorm8_table table;
+    return table;
+}
+
+inline unsigned char quantize_unorm8(float value)
+{
+    return (unsigned char)roundf(255*fmin(1.0f, fmax(0.0f, value)));
+}
+
+// Converts one scanline of "pixels" pixels. scratch must hold a destination scanline's worth of floats.
+template<bool SrcFloat, bool SrcGray, bool SrcAlpha, bool DstFloat, bool DstGray, bool DstAlpha>
+void convert_row(unsigned char * dst, const unsigned char * src, uint64_t pixels, float * scratch)
+{
+    const unsigned src_colors = SrcGray?1:3;
+    const unsigned dst_colors = DstGray?1:3;
+    const unsigned src_values = src_colors+SrcAlpha;
+    const unsigned dst_values = dst_colors+DstAlpha;
+    
+    // u8 to u8 without a luma reduction only moves values around
+    if(!SrcFloat and !DstFloat and !(DstGray and !SrcGray))
+    {
+        for(uint64_t i = 0; i < pixels; i++)
+        {
+            const unsigned char * in = src+i*src_values;
+            unsigned char * out = dst+i*dst_values;
+            for(unsigned c = 0; c < dst_colors; c++)
+                out[c] = in[SrcGray?0:c];
+            if(DstAlpha)
+                out[dst_colors] = SrcAlpha ? in[src_colors] : 255;
+        }
+        return;
+    }
+    
+    // everything else goes through linear floats, straight into the destination if it's float
+    
+    const float * srgb = get_srgb_tables().to_linear;
+    const float * unorm = get_unorm8_table().values;
+    const float * src_float = (const float *)src;
+    float * linear = DstFloat ? (float *)dst : scratch;
+    
+    for(uint64_t i = 0; i < pixels; i++)
+    {
+        float color[3];
+        for(unsigned c = 0; c < src_colors; c++)
+            color[c] = SrcFloat ? src_float[i*src_values+c] : srgb[src[i*src_values+c]];
+        float alpha = 1.0f;
+        if(SrcAlpha)
+            alpha = SrcFloat ? src_float[i*src_values+src_colors] : unorm[src[i*src_values+src_colors]];
+        
+        float * out = linear+i*dst_values;
+        if(DstGray)
+            out[0] = SrcGray ? color[0] : 0.2126f*color[0] + 0.7152f*color[1] + 0.0722f*color[2];
+        else
+            for(unsigned c = 0; c < 3; c++)
+                out[c] = color[SrcGray?0:c];
+        if(DstAlpha)
+            out[dst_colors] = alpha;
+    }
+    
+    if(!DstFloat)
+    {
+        edg_linear_to_srgb8(dst, scratch, pixels*dst_values);
+        // alpha went through the sRGB curve with everything else; redo it linearly
+        if(DstAlpha)
+            for(uint64_t i = 0; i < pixels; i++)
+                dst[i*dst_values+dst_colors] = quantize_unorm8(scratch[i*dst_values+dst_colors]);
+    }
+}
+
+typedef void (*convert_row_kernel)(unsigned char * dst, const unsigned char * src, uint64_t pixels, float * scratch);
+
+// Index is the source layout times 8 plus the destination layout.
+template<unsigned Index>
+void convert_row_indexed(unsigned char * dst, const unsigned char * src, uint64_t pixels, float * scratch)
+{
+    convert_row<bool(Index & 0x20), bool(Index & 0x10), bool(Index & 0x08),
+                bool(Index & 0x04), bool(Index & 0x02), bool(Index & 0x01)>(dst, src, pixels, scratch);
+}
+
+template<size_t... Indexes>
+convert_row_kernel pick_convert_row(unsigned index, std::index_sequence<Indexes...>)
+{
+    static const convert_row_kernel kernels[] = {convert_row_indexed<Indexes>...};
+    return kernels[index];
+}
+
+convert_row_kernel pick_convert_row(const edginfo & from, bool format, bool grayscale, bool alpha)
+{
+    unsigned index = layout_index(from.format, from.grayscale, from.alpha)*8 + layout_index(format, grayscale, alpha);
+    return pick_convert_row(index, std::make_index_sequence<64>());
+}
+
+// Converts every scanline of an image, fetching each one with row(y), into a new edg with "info"'s dimensions and flags.
+template<typename Row>
+edg * convert_rows(const edginfo & from, const edginfo & info, Row row)
+{
+    edg * dst = edg_make(info.height, info.width, info.format, info.grayscale, info.alpha, EDG_FILL_UNINITIALIZED);
+    if(!dst) return nullptr; // edgerr already set by edg_make
+    dst->info = info;
+    
+    uint64_t rows = uint64_t(info.height)+1;
+    uint64_t pixels = uint64_t(info.width)+1;
+    uint64_t dst_row_size = dst->size/rows;
+    
+    float * scratch = nullptr;
+    if(!info.format)
+    {
+        scratch = (float *)edg_allocate(dst_row_size*sizeof(float));
+        if(!scratch) return edg_kill(dst), (edgerr = "Failed to allocate memory for conversion."), nullptr;
+    }
+    
+    bool same = layout_index(from.format, from.grayscale, from.alpha) == layout_index(info.format, info.grayscale, info.alpha);
+    convert_row_kernel kernel = pick_convert_row(from, info.format, info.grayscale, info.alpha);
+    for(uint64_t y = 0; y < rows; y++)
+    {
+        if(same)
+            memcpy(dst->data+y*dst_row_size, row(y), dst_row_size);
+        else
+            kernel(dst->data+y*dst_row_size, row(y), pixels, scratch);
+    }
+    
+    edg_deallocate(scratch);
+    return dst;
+}
+
+edg * edg_convert(const edg * src, bool format, bool grayscale, bool alpha)
+{
+    if(!src) return (edgerr = "EDG is null"), nullptr;
+    if(!src->data) return (edgerr = "EDG's data is null"), nullptr;
+    
+    // keep everything but the layout
+    edginfo info = src->info;
+    info.format = format;
+    info.grayscale = grayscale;
+    info.alpha = alpha;
+    
+    return convert_rows(src->info, info, [src](uint64_t y){ return edg_row(src, y); });
+}
+
+// Scanlines are read this many bytes at a time, so that each chunk is still in cache when it's converted.
+const uint64_t open_as_chunk = 0x40000;
+
+/*
+1) make the destination image in the target layout
+2) if the layouts match, read straight into it
+3) otherwise read a chunk of scanlines at a time (byteswapped and white-filled by the reader) and convert each chunk into place
+*/
+
+edg * open_as(edg_reader * reader, bool format, bool grayscale, bool alpha)
+{
+    edginfo info = edg_reader_info(reader);
+    uint64_t rows = uint64_t(info.height)+1;
+    uint64_t pixels = uint64_t(info.width)+1;
+    uint64_t src_row_size = edg_reader_row_size(reader);
+    
+    edg * dst = edg_make(info.height, info.width, format, grayscale, alpha, EDG_FILL_UNINITIALIZED);
+    if(!dst) return nullptr; // edgerr already set by edg_make
+    
+    info.format = format;
+    info.grayscale = grayscale;
+    info.alpha = alpha;
+    info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
+    dst->info = info;
+    
+    defer dst_kill
+    ([dst](){
+        edg_kill(dst);
+    });
+    
+    edginfo from = edg_reader_info(reader);
+    if(layout_index(from.format, from.grayscale, from.alpha) == layout_index(format, grayscale, alpha))
+    {
+        if(edg_reader_read(reader, dst->data, rows) < 0) return nullptr; // edgerr already set by edg_reader_read
+        dst_kill.deferred = [](){};
+        return dst;
+    }
+    
+    uint64_t dst_row_size = dst->size/rows;
+    uint64_t chunk_rows = open_as_chunk/src_row_size;
+    if(chunk_rows == 0) chunk_rows = 1;
+    if(chunk_rows > rows) chunk_rows = rows;
+    
+    unsigned char * chunk = (unsigned char *)edg_allocate(chunk_rows*src_row_size);
+    float * scratch = format ? nullptr : (float *)edg_allocate(dst_row_size*sizeof(float));
+    defer buffers_free
+    ([chunk, scratch](){
+        edg_deallocate(chunk);
+        edg_deallocate(scratch);
+    });
+    if(!chunk or (!format and !scratch)) return (edgerr = "Failed to allocate memory for conversion."), nullptr;
+    
+    convert_row_kernel kernel = pick_convert_row(from, format, grayscale, alpha);
+    for(uint64_t y = 0; y < rows; y += chunk_rows)
+    {
+        int64_t got = edg_reader_read(reader, chunk, chunk_rows);
+        if(got < 0) return nullptr; // edgerr already set by edg_reader_read
+        for(int64_t i = 0; i < got; i++)
+            kernel(dst->data+(y+i)*dst_row_size, chunk+i*src_row_size, pixels, scratch);
+    }
+    
+    dst_kill.deferred = [](){};
+    return dst;
+}
+
+edg * edg_open_as(const char * fname, bool format, bool grayscale, bool alpha)
+{
+    edg_reader * reader = edg_reader_open(fname);
+    if(!reader) return nullptr; // edgerr already set by edg_reader_open
+    edg * edge = open_as(reader, format, grayscale, alpha);
+    edg_reader_close(reader);
+    return edge;
+}
+
+edg * edg_open_stream_as(std::istream & stream, bool format, bool grayscale, bool alpha)
+{
+    edg_reader * reader = edg_reader_open_stream(stream);
+    if(!reader) return nullptr; // edgerr already set by edg_reader_open_stream
+    edg * edge = open_as(reader, format, grayscale, alpha);
+    edg_reader_close(reader);
+    return edge;
+}
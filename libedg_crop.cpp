@@ -0,0 +1,99 @@
+/*
+   Copyright 2016 Alexander Nadeau <wareya@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "LICENSE");
+   you may not use this file except in compliance with the LICENSE.
+   You may obtain a copy of the LICENSE at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the LICENSE is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the LICENSE for the specific language governing permissions and
+   limitations under the LICENSE.
+*/
+
+// Crops: rectangles of an image that point into its buffer instead of copying it.
+// Included by libedg.cpp after libedg_convert.cpp; not meant to be compiled on its own.
+
+// Fills in a crop of the rectangle at y, x inside "info", with "data" pointing at the rectangle's top left pixel.
+// Like edg_open_region, the crop only keeps the tile flags of the image edges it touches.
+void make_crop(const edginfo & info, unsigned char * data, uint64_t stride, uint32_t y, uint32_t x, uint32_t height, uint32_t width, edg_crop * crop)
+{
+    unsigned pixelsize = pixel_length(info.grayscale, info.alpha, info.format);
+    
+    crop->info = info;
+    crop->info.height = height;
+    crop->info.width = width;
+    crop->info.tileup    = info.tileup    and y == 0;
+    crop->info.tiledown  = info.tiledown  and uint64_t(y)+height == info.height;
+    crop->info.tileleft  = info.tileleft  and x == 0;
+    crop->info.tileright = info.tileright and uint64_t(x)+width == info.width;
+    crop->data = data + y*stride + uint64_t(x)*pixelsize;
+    crop->stride = stride;
+}
+
+int32_t edg_crop_make(edg * edge, uint32_t y, uint32_t x, uint32_t height, uint32_t width, edg_crop * crop)
+{
+    if(!edge) return (edgerr = "EDG is null"), -1;
+    if(!edge->data) return (edgerr = "EDG's data is null"), -1;
+    if(!crop) return (edgerr = "Crop is null"), -1;
+    if(uint64_t(y)+height > edge->info.height or uint64_t(x)+width > edge->info.width)
+        return (edgerr = "Crop does not fit inside the image."), -1;
+    
+    // virtual white scanlines have no memory of their own to point into
+    uint64_t rows = uint64_t(edge->info.height)+1;
+    if(uint64_t(y)+height >= rows-edge->white_rows)
+        return (edgerr = "Crop reaches virtual white scanlines; call edg_materialize first."), -1;
+    
+    make_crop(edge->info, edge->data, edge->size/rows, y, x, height, width, crop);
+    return 0;
+}
+
+int32_t edg_crop_sub(const edg_crop * parent, uint32_t y, uint32_t x, uint32_t height, uint32_t width, edg_crop * crop)
+{
+    if(!parent) return (edgerr = "Parent crop is null"), -1;
+    if(!crop) return (edgerr = "Crop is null"), -1;
+    if(uint64_t(y)+height > parent->info.height or uint64_t(x)+width > parent->info.width)
+        return (edgerr = "Crop does not fit inside the parent crop."), -1;
+    
+    make_crop(parent->info, parent->data, parent->stride, y, x, height, width, crop);
+    return 0;
+}
+
+const unsigned char * edg_crop_row(const edg_crop * crop, uint64_t y)
+{
+    return crop->data + y*crop->stride;
+}
+
+edg * edg_crop_copy(const edg_crop * crop, bool format, bool grayscale, bool alpha)
+{
+    if(!crop) return (edgerr = "Crop is null"), nullptr;
+    
+    edginfo info = crop->info;
+    info.format = format;
+    info.grayscale = grayscale;
+    info.alpha = alpha;
+    
+    return convert_rows(crop->info, info, [crop](uint64_t y){ return edg_crop_row(crop, y); });
+}
+
+// Crop rows aren't contiguous, so they go out one scanline per write.
+int32_t edg_crop_save(const edg_crop * crop, const char * fname)
+{
+    if(!crop) return (edgerr = "Crop is null"), -1;
+    if(!fname) return (edgerr = "Filename is null"), -1;
+    
+    edg_writer * writer = edg_writer_open(fname, &crop->info);
+    if(!writer) return -2; // edgerr already set by edg_writer_open
+    
+    uint64_t rows = uint64_t(crop->info.height)+1;
+    for(uint64_t y = 0; y < rows; y++)
+    {
+        int32_t rcode = edg_writer_write(writer, edg_crop_row(crop, y), 1);
+        if(rcode < 0) return edg_writer_close(writer), rcode; // edgerr already set by edg_writer_write
+    }
+    
+    return edg_writer_close(writer);
+}
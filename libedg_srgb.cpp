@@ -0,0 +1,197 @@
+/*
+   Copyright 2016 Alexander Nadeau <wareya@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "LICENSE");
+   you may not use this file except in compliance with the LICENSE.
+   You may obtain a copy of the LICENSE at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the LICENSE is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the LICENSE for the specific language governing permissions and
+   limitations under the LICENSE.
+*/
+
+// Table-driven conversion between linear floats and 8-bit sRGB.
+// Included by libedg.cpp after srgb2linear and linear2srgb; not meant to be compiled on its own.
+//
+// sRGB u8 to linear is a 256-entry table of srgb2linear.
+// Linear to sRGB u8 gives exactly what round(255*clamp(linear2srgb(x))) would, without calling powf:
+// a 4096-entry table indexed by the top bits of the float gives the answer at the start of each bucket, and the buckets are
+// narrow enough that at most one rounding threshold falls inside any of them, so one comparison against that threshold fixes up the rest.
+// The thresholds are found once, by bisecting over float bit patterns against linear2srgb itself.
+// x86 gets an AVX2 kernel with gathers, picked once at runtime from CPUID.
+
+#include <stdint.h>
+#include <string.h> // memcpy
+#include <math.h> // roundf
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define EDG_SRGB_X86 1
+#include <immintrin.h>
+#else
+#define EDG_SRGB_X86 0
+#endif
+
+// Buckets cover [2^-16, 1), 256 to a binade. Everything below 2^-16 rounds to 0.
+const uint32_t srgb_lut_base = 0x37800000; // 2^-16
+const int srgb_lut_shift = 15; // keeps 8 bits of mantissa
+const uint32_t srgb_lut_size = 0x1000;
+
+struct srgb_tables
+{
+    float to_linear[256];
+    // three bytes of padding so that the AVX2 kernel can gather it 32 bits at a time
+    unsigned char lut[srgb_lut_size+3];
+    // thresholds[k] is the smallest float that converts to k or more. thresholds[256] is infinity.
+    float thresholds[257];
+};
+
+// The conversion the table reproduces. NaN converts to 0.
+unsigned char linear2srgb8_reference(float linear)
+{
+    return (unsigned char)roundf(255*fmin(1.0f, fmax(0.0f, linear2srgb(linear))));
+}
+
+float float_from_bits(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+}
+
+uint32_t bits_from_float(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    return bits;
+}
+
+srgb_tables build_srgb_tables()
+{
+    srgb_tables tables;
+    
+    for(int i = 0; i < 256; i++)
+        tables.to_linear[i] = srgb2linear(i/255.0f);
+    
+    // non-negative floats sort the same as their bit patterns, so bisect over those
+    tables.thresholds[0] = -INFINITY;
+    for(int k = 1; k < 256; k++)
+    {
+        uint32_t low = 0, high = bits_from_float(1.0f);
+        while(low < high)
+        {
+            uint32_t mid = low+(high-low)/2;
+            if(linear2srgb8_reference(float_from_bits(mid)) >= k)
+                high = mid;
+            else
+                low = mid+1;
+        }
+        tables.thresholds[k] = float_from_bits(low);
+    }
+    tables.thresholds[256] = INFINITY;
+    
+    for(uint32_t i = 0; i < srgb_lut_size; i++)
+        tables.lut[i] = linear2srgb8_reference(float_from_bits(srgb_lut_base+(i << srgb_lut_shift)));
+    memset(tables.lut+srgb_lut_size, 0, 3);
+    
+    return tables;
+}
+
+const srgb_tables & get_srgb_tables()
+{
+    static const srgb_tables tables = build_srgb_tables();
+    return tables;
+}
+
+void srgb8_to_linear_scalar(float * dst, const unsigned char * src, uint64_t count)
+{
+    const float * table = get_srgb_tables().to_linear;
+    for(uint64_t i = 0; i < count; i++)
+        dst[i] = table[src[i]];
+}
+
+void linear_to_srgb8_scalar(unsigned char * dst, const float * src, uint64_t count)
+{
+    const srgb_tables & tables = get_srgb_tables();
+    for(uint64_t i = 0; i < count; i++)
+    {
+        float value = src[i];
+        // written so that NaN takes the first branch
+        if(!(value > 0.0f)) value = 0.0f;
+        if(value > 1.0f) value = 1.0f;
+        
+        int32_t index = (int32_t(bits_from_float(value))-int32_t(srgb_lut_base)) >> srgb_lut_shift;
+        if(index < 0) index = 0;
+        if(index > int32_t(srgb_lut_size-1)) index = srgb_lut_size-1;
+        
+        unsigned char result = tables.lut[index];
+        result += value >= tables.thresholds[result+1];
+        dst[i] = result;
+    }
+}
+
+#if EDG_SRGB_X86
+
+__attribute__((target("avx2")))
+void linear_to_srgb8_avx2(unsigned char * dst, const float * src, uint64_t count)
+{
+    const srgb_tables & tables = get_srgb_tables();
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256i base = _mm256_set1_epi32(srgb_lut_base);
+    const __m256i first = _mm256_setzero_si256();
+    const __m256i last = _mm256_set1_epi32(srgb_lut_size-1);
+    const __m256i low_byte = _mm256_set1_epi32(0xFF);
+    
+    uint64_t i = 0;
+    for(; i+8 <= count; i += 8)
+    {
+        __m256 value = _mm256_loadu_ps(src+i);
+        // maxps returns its second operand when either is NaN, so NaN becomes 0
+        value = _mm256_min_ps(_mm256_max_ps(value, zero), one);
+        
+        __m256i index = _mm256_srai_epi32(_mm256_sub_epi32(_mm256_castps_si256(value), base), srgb_lut_shift);
+        index = _mm256_min_epi32(_mm256_max_epi32(index, first), last);
+        
+        __m256i result = _mm256_and_si256(_mm256_i32gather_epi32((const int *)tables.lut, index, 1), low_byte);
+        __m256 threshold = _mm256_i32gather_ps(tables.thresholds+1, result, 4);
+        // a true comparison is all ones, which is -1
+        result = _mm256_sub_epi32(result, _mm256_castps_si256(_mm256_cmp_ps(value, threshold, _CMP_GE_OQ)));
+        
+        __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+        _mm_storel_epi64((__m128i *)(dst+i), _mm_packus_epi16(words, words));
+    }
+    linear_to_srgb8_scalar(dst+i, src+i, count-i);
+}
+
+#endif // EDG_SRGB_X86
+
+typedef void (*linear_to_srgb8_kernel)(unsigned char * dst, const float * src, uint64_t count);
+
+linear_to_srgb8_kernel pick_linear_to_srgb8()
+{
+    #if EDG_SRGB_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return linear_to_srgb8_avx2;
+    #endif
+    return linear_to_srgb8_scalar;
+}
+
+const float * edg_srgb8_table()
+{
+    return get_srgb_tables().to_linear;
+}
+
+void edg_srgb8_to_linear(float * dst, const unsigned char * src, uint64_t count)
+{
+    srgb8_to_linear_scalar(dst, src, count);
+}
+
+void edg_linear_to_srgb8(unsigned char * dst, const float * src, uint64_t count)
+{
+    static const linear_to_srgb8_kernel kernel = pick_linear_to_srgb8();
+    kernel(dst, src, count);
+}
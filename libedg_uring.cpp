@@ -0,0 +1,555 @@
+/*
+   Copyright 2016 Alexander Nadeau <wareya@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "LICENSE");
+   you may not use this file except in compliance with the LICENSE.
+   You may obtain a copy of the LICENSE at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the LICENSE is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the LICENSE for the specific language governing permissions and
+   limitations under the LICENSE.
+*/
+
+// Batched loading and saving of many EDG files at once.
+// Included by libedg.cpp; not meant to be compiled on its own.
+//
+// Built with EDG_USE_IO_URING defined (and linked with -luring), the opens, stats, reads, writes and closes for a
+// whole window of files are queued on an io_uring and submitted together, instead of costing a syscall each.
+// Without it, or when the kernel can't set up a ring with every operation needed, each file just goes through edg_open or edg_save.
+//
+// g++ --std=c++14 -DEDG_USE_IO_URING yourprogram.cpp libedg.cpp -luring -pthread
+
+#if defined(EDG_USE_IO_URING) && defined(__linux__)
+#define EDG_IO_URING 1
+#include <liburing.h>
+#else
+#define EDG_IO_URING 0
+#endif
+
+#if EDG_IO_URING
+
+// Files handled per round. Only this many files are open at once.
+const uint64_t uring_window = 64;
+const unsigned uring_depth = 256;
+// Largest single read or write; io_uring lengths are 32-bit.
+const uint64_t uring_chunk = 0x40000000;
+
+// Sets up a ring, and checks that the kernel supports every operation used here.
+// Kernels before 5.6 can set up a ring but can't open, stat or close through it, so those get no ring at all.
+bool uring_init(struct io_uring * ring)
+{
+    if(io_uring_queue_init(uring_depth, ring, 0) != 0) return false;
+    
+    struct io_uring_probe * probe = io_uring_get_probe_ring(ring);
+    bool supported = probe
+        and io_uring_opcode_supported(probe, IORING_OP_OPENAT)
+        and io_uring_opcode_supported(probe, IORING_OP_STATX)
+        and io_uring_opcode_supported(probe, IORING_OP_READ)
+        and io_uring_opcode_supported(probe, IORING_OP_WRITE)
+        and io_uring_opcode_supported(probe, IORING_OP_CLOSE);
+    if(probe) io_uring_free_probe(probe);
+    
+    if(!supported) io_uring_queue_exit(ring);
+    return supported;
+}
+
+struct uring_file
+{
+    int fd = -1;
+    const char * error = nullptr; // once set, the file is skipped by every later round
+    
+    // loading
+    struct statx stat;
+    unsigned char header[0x10];
+    int header_read = 0;
+    edginfo info;
+    unsigned char * data = nullptr;
+    uint64_t capacity = 0;
+    uint64_t bytes_to_read = 0;
+    uint64_t bytes_to_store = 0;
+    uint64_t row_size = 0;
+    bool truncated = false;
+    
+    // saving
+    unsigned char * converted = nullptr; // foreign-endian float data, swapped for writing
+};
+
+// Every file of a window. Kept off the stack, so that it can be leaked if the ring breaks with operations still pointing into it.
+struct uring_files
+{
+    uring_file files[uring_window];
+};
+
+// A read or write of one span of a file, resubmitted from where it left off until it's done.
+struct uring_transfer
+{
+    uint64_t file;
+    unsigned char * buffer;
+    uint64_t length;
+    uint64_t offset;
+};
+
+// After a failed submit, waits for every operation that the kernel already took, handing each to complete(data, res),
+// so that none is left pointing at memory that's about to be freed. Operations still in the submission queue were never seen by the kernel.
+// in_flight counts both. Returns false if the ring can't even be waited on, in which case that memory must be leaked instead.
+template<typename Complete>
+bool uring_drain(struct io_uring * ring, uint64_t in_flight, Complete complete)
+{
+    in_flight -= io_uring_sq_ready(ring);
+    while(in_flight > 0)
+    {
+        struct io_uring_cqe * cqe;
+        int rcode = io_uring_wait_cqe(ring, &cqe);
+        if(rcode == -EINTR) continue;
+        if(rcode < 0) return false;
+        complete(uint64_t(uintptr_t(io_uring_cqe_get_data(cqe))), cqe->res);
+        io_uring_cqe_seen(ring, cqe);
+        in_flight--;
+    }
+    return true;
+}
+
+// Submits one operation per index in [0, count) for which want(i) holds, a ring's worth at a time, and reaps them.
+// prep(sqe, i) fills in the operation, and complete(i, res) gets its result.
+// Returns 0 on success. If the ring fails, returns -1 once nothing is in flight anymore, or -2 if operations may still be in flight.
+template<typename Want, typename Prep, typename Complete>
+int32_t uring_round(struct io_uring * ring, uint64_t count, Want want, Prep prep, Complete complete)
+{
+    uint64_t next = 0;
+    uint64_t in_flight = 0;
+    while(next < count or in_flight > 0)
+    {
+        for(; next < count; next++)
+        {
+            if(!want(next)) continue;
+            struct io_uring_sqe * sqe = io_uring_get_sqe(ring);
+            if(!sqe) break;
+            prep(sqe, next);
+            io_uring_sqe_set_data(sqe, (void *)uintptr_t(next));
+            in_flight++;
+        }
+        if(in_flight == 0) break;
+        
+        int rcode;
+        do rcode = io_uring_submit_and_wait(ring, 1);
+        while(rcode == -EINTR);
+        if(rcode < 0) return uring_drain(ring, in_flight, complete) ? -1 : -2;
+        struct io_uring_cqe * cqe;
+        while(in_flight > 0 and io_uring_peek_cqe(ring, &cqe) == 0)
+        {
+            complete(uint64_t(uintptr_t(io_uring_cqe_get_data(cqe))), cqe->res);
+            io_uring_cqe_seen(ring, cqe);
+            in_flight--;
+        }
+    }
+    return 0;
+}
+
+// Runs every transfer in the queue to completion, splitting anything longer than uring_chunk and resubmitting short transfers.
+// A transfer that fails, or makes no progress, sets "error" on its file. Returns what uring_round does.
+int32_t uring_transfer_all(struct io_uring * ring, uring_file * files, std::deque<uring_transfer> & queue, bool write, const char * error)
+{
+    std::vector<uring_transfer> slots;
+    std::vector<uint64_t> free_slots;
+    uint64_t in_flight = 0;
+    while(!queue.empty() or in_flight > 0)
+    {
+        while(!queue.empty())
+        {
+            uring_transfer & transfer = queue.front();
+            if(files[transfer.file].error)
+            {
+                queue.pop_front();
+                continue;
+            }
+            struct io_uring_sqe * sqe = io_uring_get_sqe(ring);
+            if(!sqe) break;
+            
+            unsigned length = unsigned(transfer.length < uring_chunk ? transfer.length : uring_chunk);
+            int fd = files[transfer.file].fd;
+            if(write)
+                io_uring_prep_write(sqe, fd, transfer.buffer, length, transfer.offset);
+            else
+                io_uring_prep_read(sqe, fd, transfer.buffer, length, transfer.offset);
+            
+            uint64_t slot;
+            if(free_slots.empty())
+            {
+                slot = slots.size();
+                slots.push_back(transfer);
+            }
+            else
+            {
+                slot = free_slots.back();
+                free_slots.pop_back();
+                slots[slot] = transfer;
+            }
+            io_uring_sqe_set_data(sqe, (void *)uintptr_t(slot));
+            queue.pop_front();
+            in_flight++;
+        }
+        if(in_flight == 0) break;
+        
+        int rcode;
+        do rcode = io_uring_submit_and_wait(ring, 1);
+        while(rcode == -EINTR);
+        if(rcode < 0) return uring_drain(ring, in_flight, [](uint64_t, int){}) ? -1 : -2;
+        struct io_uring_cqe * cqe;
+        while(in_flight > 0 and io_uring_peek_cqe(ring, &cqe) == 0)
+        {
+            uint64_t slot = uintptr_t(io_uring_cqe_get_data(cqe));
+            int res = cqe->res;
+            io_uring_cqe_seen(ring, cqe);
+            in_flight--;
+            free_slots.push_back(slot);
+            
+            uring_transfer transfer = slots[slot];
+            // a read that returns nothing means the file shrank after it was measured
+            if(res <= 0)
+                files[transfer.file].error = error;
+            else if(uint64_t(res) < transfer.length)
+                queue.push_back({transfer.file, transfer.buffer+res, transfer.length-res, transfer.offset+res});
+        }
+    }
+    return 0;
+}
+
+// Closes every open file in the window, keeping the first error that a close reports for files that were being written.
+int32_t uring_close_all(struct io_uring * ring, uring_file * files, uint64_t count, bool write)
+{
+    return uring_round(ring, count,
+        [&](uint64_t i){ return files[i].fd >= 0; },
+        [&](struct io_uring_sqe * sqe, uint64_t i){ io_uring_prep_close(sqe, files[i].fd); },
+        [&](uint64_t i, int res){
+            files[i].fd = -1;
+            if(res < 0 and write and !files[i].error)
+                files[i].error = "Failed to flush image data to file. File may be truncated.";
+        });
+}
+
+/*
+1) open every file in the window
+2) get each file's length and read its header, together
+3) parse headers, check sizes and allocate buffers, as edg_open does
+4) read all image data
+5) close every file
+6) byteswap and fill in truncated image area, and hand out the edgs
+*/
+
+// Loads a window of files through the ring. Returns false if the ring itself failed, which leaves nothing allocated,
+// unless operations were stuck in flight, in which case everything they point into is leaked rather than freed under them.
+bool uring_open_window(struct io_uring * ring, const char * const * fnames, uint64_t count, uint32_t flags, edg ** edges, const char ** errors)
+{
+    uring_files * window = edg_new<uring_files>();
+    if(!window) return false;
+    uring_file * files = window->files;
+    
+    defer cleanup
+    ([&](){
+        for(uint64_t i = 0; i < count; i++)
+        {
+            if(files[i].fd >= 0) close(files[i].fd);
+            edg_release_pixels(files[i].data, files[i].capacity);
+        }
+        edg_delete(window);
+    });
+    
+    auto failed = [&](int32_t rcode){
+        if(rcode == -2) cleanup.deferred = [](){};
+        return rcode < 0;
+    };
+    
+    int32_t rcode = uring_round(ring, count,
+        [&](uint64_t){ return true; },
+        [&](struct io_uring_sqe * sqe, uint64_t i){ io_uring_prep_openat(sqe, AT_FDCWD, fnames[i], O_RDONLY|O_CLOEXEC, 0); },
+        [&](uint64_t i, int res){
+            if(res < 0) files[i].error = "Failed to open file.";
+            else files[i].fd = res;
+        });
+    if(failed(rcode)) return false;
+    
+    // two operations per file: even ones get the length, odd ones read the header
+    rcode = uring_round(ring, count*2,
+        [&](uint64_t op){ return !files[op/2].error; },
+        [&](struct io_uring_sqe * sqe, uint64_t op){
+            uring_file & file = files[op/2];
+            if(op%2 == 0)
+                io_uring_prep_statx(sqe, file.fd, "", AT_EMPTY_PATH, STATX_SIZE, &file.stat);
+            else
+                io_uring_prep_read(sqe, file.fd, file.header, 0x10, 0);
+        },
+        [&](uint64_t op, int res){
+            uring_file & file = files[op/2];
+            if(file.error) return;
+            if(op%2 == 0 and res < 0)
+                file.error = "Failed while determining file length.";
+            if(op%2 == 1)
+                file.header_read = res;
+        });
+    if(failed(rcode)) return false;
+    
+    std::deque<uring_transfer> reads;
+    for(uint64_t i = 0; i < count; i++)
+    {
+        uring_file & file = files[i];
+        if(file.error) continue;
+        
+        uint64_t length = file.stat.stx_size;
+        if(length < 0x10)
+        {
+            file.error = "Invalid EDG file - is not long enough to contain a header, or is so long that the length counter overflowed.";
+            continue;
+        }
+        if(file.header_read != 0x10)
+        {
+            file.error = "Failed to read header from file.";
+            continue;
+        }
+        if(parse_header(file.header, &file.info, &file.error) < 0) continue;
+        
+        unsigned pixelsize = pixel_length(file.info.grayscale, file.info.alpha, file.info.format);
+        uint64_t pixels_tall = uint64_t(file.info.height)+1;
+        uint64_t pixels_wide = uint64_t(file.info.width)+1;
+        file.bytes_to_store = pixels_wide*pixels_tall*pixelsize;
+        file.row_size = pixels_wide*pixelsize;
+        
+        if(file.bytes_to_store/pixels_wide/pixels_tall != pixelsize)
+        {
+            file.error = "Can't load EDG file - image data contains too many byte values to address in 64-bit space.";
+            continue;
+        }
+        if(uint64_t(size_t(file.bytes_to_store)) != file.bytes_to_store)
+        {
+            file.error = "Can't load EDG file - image data too large to fit into size_t.";
+            continue;
+        }
+        
+        uint64_t imagebytes = length-0x10;
+        file.truncated = imagebytes < file.bytes_to_store;
+        // cut off any incomplete pixel that may be at the end of the image data
+        file.bytes_to_read = file.truncated ? (imagebytes/pixelsize)*pixelsize : file.bytes_to_store;
+        
+        file.data = edg_allocate_pixels(file.bytes_to_store, &file.capacity, false);
+        if(!file.data)
+        {
+            file.error = "Failed to allocate memory for buffer. If it's a large image, use a stream.";
+            continue;
+        }
+        if(file.bytes_to_read > 0)
+            reads.push_back({i, file.data, file.bytes_to_read, 0x10});
+    }
+    
+    if(failed(uring_transfer_all(ring, files, reads, false, "Failed to read image data into RAM."))) return false;
+    if(failed(uring_close_all(ring, files, count, false))) return false;
+    
+    for(uint64_t i = 0; i < count; i++)
+    {
+        uring_file & file = files[i];
+        if(file.error)
+        {
+            errors[i] = file.error;
+            continue;
+        }
+        
+        edg * edge = edg_new<edg>();
+        if(!edge)
+        {
+            errors[i] = "Failed to allocate edg metadata structure.";
+            continue;
+        }
+        
+        if(file.info.format and file.info.endian != HAVE_LITTLE_ENDIAN_PLATFORM)
+            swap_values(file.data, file.bytes_to_read, 4);
+        file.info.endian = HAVE_LITTLE_ENDIAN_PLATFORM;
+        
+        if(file.truncated)
+            fill_truncated(file.data, file.bytes_to_read, file.bytes_to_store, file.row_size, file.info.format, flags, &edge->white_rows, &edge->white_row);
+        
+        edge->info = file.info;
+        edge->size = file.bytes_to_store;
+        edge->data = file.data;
+        edge->capacity = file.capacity;
+        file.data = nullptr;
+        
+        edges[i] = edge;
+        errors[i] = "";
+    }
+    
+    return true;
+}
+
+/*
+1) open (and truncate) every file in the window
+2) write every header and all image data, converting foreign-endian floats into a scratch buffer first
+3) close every file
+*/
+
+// Saves a window of edgs through the ring. Returns false if the ring itself failed, leaking like uring_open_window if operations were stuck in flight.
+bool uring_save_window(struct io_uring * ring, edg * const * edges, const char * const * fnames, uint64_t count, const char ** errors)
+{
+    uring_files * window = edg_new<uring_files>();
+    if(!window) return false;
+    uring_file * files = window->files;
+    
+    defer cleanup
+    ([&](){
+        for(uint64_t i = 0; i < count; i++)
+        {
+            if(files[i].fd >= 0) close(files[i].fd);
+            edg_deallocate(files[i].converted);
+        }
+        edg_delete(window);
+    });
+    
+    auto failed = [&](int32_t rcode){
+        if(rcode == -2) cleanup.deferred = [](){};
+        return rcode < 0;
+    };
+    
+    for(uint64_t i = 0; i < count; i++)
+    {
+        if(!edges[i]) files[i].error = "EDG is null";
+        else if(!edges[i]->data) files[i].error = "EDG's data is null";
+    }
+    
+    int32_t rcode = uring_round(ring, count,
+        [&](uint64_t i){ return !files[i].error; },
+        [&](struct io_uring_sqe * sqe, uint64_t i){ io_uring_prep_openat(sqe, AT_FDCWD, fnames[i], O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666); },
+        [&](uint64_t i, int res){
+            if(res < 0) files[i].error = "Failed to open file.";
+            else files[i].fd = res;
+        });
+    if(failed(rcode)) return false;
+    
+    std::deque<uring_transfer> writes;
+    for(uint64_t i = 0; i < count; i++)
+    {
+        uring_file & file = files[i];
+        if(file.error) continue;
+        
+        const edg * edge = edges[i];
+        uint64_t bytes = stored_bytes(edge);
+        unsigned char * data = edge->data;
+        if(edge->info.endian != HAVE_LITTLE_ENDIAN_PLATFORM and edge->info.format and bytes > 0)
+        {
+            file.converted = (unsigned char *)edg_allocate(bytes);
+            if(!file.converted)
+            {
+                file.error = "Failed to allocate memory for converting image data.";
+                continue;
+            }
+            edg_byteswap32(file.converted, edge->data, bytes/4);
+            data = file.converted;
+        }
+        
+        build_header(edge->info, file.header);
+        writes.push_back({i, file.header, 0x10, 0});
+        if(bytes > 0)
+            writes.push_back({i, data, bytes, 0x10});
+    }
+    
+    if(failed(uring_transfer_all(ring, files, writes, true, "Failed to write image data to file. File may be truncated."))) return false;
+    if(failed(uring_close_all(ring, files, count, true))) return false;
+    
+    for(uint64_t i = 0; i < count; i++)
+        errors[i] = files[i].error ? files[i].error : "";
+    
+    return true;
+}
+
+#endif // EDG_IO_URING
+
+int64_t edg_open_batch(const char * const * fnames, uint64_t count, edg ** edges, const char ** errors, uint32_t flags)
+{
+    if(!fnames and count > 0) return (edgerr = "Filename list is null"), -1;
+    if(!edges and count > 0) return (edgerr = "EDG list is null"), -1;
+    for(uint64_t i = 0; i < count; i++)
+        if(!fnames[i]) return (edgerr = "Filename is null"), -1;
+    
+    std::vector<const char *> own_errors;
+    if(!errors)
+    {
+        own_errors.resize(count);
+        errors = own_errors.data();
+    }
+    
+    for(uint64_t i = 0; i < count; i++)
+    {
+        edges[i] = nullptr;
+        errors[i] = "";
+    }
+    
+    uint64_t done = 0;
+    
+    #if EDG_IO_URING
+    struct io_uring ring;
+    if(uring_init(&ring))
+    {
+        for(; done < count; done += uring_window)
+        {
+            uint64_t window = count-done < uring_window ? count-done : uring_window;
+            if(!uring_open_window(&ring, fnames+done, window, flags, edges+done, errors+done)) break;
+        }
+        io_uring_queue_exit(&ring);
+    }
+    #endif
+    
+    // without a ring, or if it broke partway through
+    for(; done < count; done++)
+    {
+        edges[done] = edg_open(fnames[done], flags);
+        if(!edges[done]) errors[done] = edgerr;
+    }
+    
+    int64_t failures = 0;
+    for(uint64_t i = 0; i < count; i++)
+        if(!edges[i]) failures++;
+    
+    return failures;
+}
+
+int64_t edg_save_batch(edg * const * edges, const char * const * fnames, uint64_t count, const char ** errors)
+{
+    if(!edges and count > 0) return (edgerr = "EDG list is null"), -1;
+    if(!fnames and count > 0) return (edgerr = "Filename list is null"), -1;
+    for(uint64_t i = 0; i < count; i++)
+        if(!fnames[i]) return (edgerr = "Filename is null"), -1;
+    
+    std::vector<const char *> own_errors;
+    if(!errors)
+    {
+        own_errors.resize(count);
+        errors = own_errors.data();
+    }
+    
+    for(uint64_t i = 0; i < count; i++)
+        errors[i] = "";
+    
+    uint64_t done = 0;
+    
+    #if EDG_IO_URING
+    struct io_uring ring;
+    if(uring_init(&ring))
+    {
+        for(; done < count; done += uring_window)
+        {
+            uint64_t window = count-done < uring_window ? count-done : uring_window;
+            if(!uring_save_window(&ring, edges+done, fnames+done, window, errors+done)) break;
+        }
+        io_uring_queue_exit(&ring);
+    }
+    #endif
+    
+    for(; done < count; done++)
+        if(edg_save(edges[done], fnames[done]) < 0) errors[done] = edgerr;
+    
+    int64_t failures = 0;
+    for(uint64_t i = 0; i < count; i++)
+        if(errors[i][0] != '\0') failures++;
+    
+    return failures;
+}
@@ -0,0 +1,120 @@
+#ifndef EDGUP_VIEW
+#define EDGUP_VIEW
+
+/*
+   Copyright 2016 Alexander Nadeau <wareya@gmail.com>
+
+   Licensed under the Apache License, Version 2.0 (the "LICENSE");
+   you may not use this file except in compliance with the LICENSE.
+   You may obtain a copy of the LICENSE at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the LICENSE is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the LICENSE for the specific language governing permissions and
+   limitations under the LICENSE.
+*/
+
+// Typed access to an edg's pixels, with the value type and channel count fixed at compile time.
+// Header-only. Write a filter once as a template over the view type, and let edg_visit pick the instantiation for each image,
+// so that the inner loops don't branch on the format or recompute the channel count.
+
+#include "libedg.hpp"
+
+#include <stdint.h>
+#include <type_traits> // std::is_same
+
+// T is uint8_t or float. Channels is the number of values per pixel: 1 (gray), 2 (gray and alpha), 3 (RGB) or 4 (RGBA).
+// Unlike edginfo, height and width are counts of pixels, not counts minus one.
+template<typename T, unsigned Channels>
+struct edg_view
+{
+    static_assert(std::is_same<T, uint8_t>::value or std::is_same<T, float>::value, "edg_view values are uint8_t or float.");
+    static_assert(Channels >= 1 and Channels <= 4, "edg_view has 1 to 4 channels.");
+    
+    typedef T value_type;
+    static const unsigned channels = Channels;
+    
+    T * data;
+    uint64_t height;
+    uint64_t width;
+    // values from the start of one row to the start of the next
+    uint64_t stride;
+    
+    // Whether an image with this info can be viewed as this type.
+    static bool matches(const edginfo & info)
+    {
+        return info.format == std::is_same<T, float>::value and (info.grayscale?1:3)+info.alpha == Channels;
+    }
+    
+    // Views a whole edg, which must match (see matches) and have no virtual white scanlines (see edg_materialize).
+    explicit edg_view(edg * edge)
+        : data((T *)edge->data), height(uint64_t(edge->info.height)+1), width(uint64_t(edge->info.width)+1), stride(width*Channels) {}
+    // Views a crop, which must match; see edg_crop_make.
+    explicit edg_view(const edg_crop & crop)
+        : data((T *)crop.data), height(uint64_t(crop.info.height)+1), width(uint64_t(crop.info.width)+1), stride(crop.stride/sizeof(T)) {}
+    
+    T * row(uint64_t y) const { return data + y*stride; }
+    T * pixel(uint64_t y, uint64_t x) const { return data + y*stride + x*Channels; }
+    T & operator()(uint64_t y, uint64_t x, unsigned channel) const { return data[y*stride + x*Channels + channel]; }
+};
+
+// Calls f with the edg_view type that matches "info", viewing "source" (an edg * or an edg_crop).
+template<typename Source, typename F>
+void visit_layout(const edginfo & info, Source source, F && f)
+{
+    unsigned channels = (info.grayscale?1:3)+info.alpha;
+    if(info.format)
+    {
+        switch(channels)
+        {
+        case 1: f(edg_view<float, 1>(source)); break;
+        case 2: f(edg_view<float, 2>(source)); break;
+        case 3: f(edg_view<float, 3>(source)); break;
+        case 4: f(edg_view<float, 4>(source)); break;
+        }
+    }
+    else
+    {
+        switch(channels)
+        {
+        case 1: f(edg_view<uint8_t, 1>(source)); break;
+        case 2: f(edg_view<uint8_t, 2>(source)); break;
+        case 3: f(edg_view<uint8_t, 3>(source)); break;
+        case 4: f(edg_view<uint8_t, 4>(source)); break;
+        }
+    }
+}
+
+// Calls f once with the edg_view type that matches the image, so that f (usually a generic lambda) is compiled for each layout,
+// and the dispatch happens once per image instead of once per value.
+// Materializes virtual white scanlines first, since views only see real memory.
+// Returns an error code and sets edgerr on error.
+template<typename F>
+int32_t edg_visit(edg * edge, F && f)
+{
+    if(!edge) return (edgerr = "EDG is null"), -1;
+    if(!edge->data) return (edgerr = "EDG's data is null"), -1;
+    if(edge->white_rows > 0)
+    {
+        int32_t rcode = edg_materialize(edge);
+        if(rcode < 0) return rcode; // edgerr already set by edg_materialize
+    }
+    
+    visit_layout(edge->info, edge, f);
+    return 0;
+}
+
+// Like edg_visit, but for a crop, whose view has the crop's stride.
+template<typename F>
+int32_t edg_visit(const edg_crop * crop, F && f)
+{
+    if(!crop) return (edgerr = "Crop is null"), -1;
+    
+    visit_layout(crop->info, *crop, f);
+    return 0;
+}
+
+#endif // EDGUP_VIEW